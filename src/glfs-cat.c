@@ -22,6 +22,7 @@
 #include <config.h>
 
 #include "glfs-cat.h"
+#include "glfs-transfer.h"
 #include "glfs-util.h"
 
 #include <errno.h>
@@ -42,21 +43,39 @@
  * gluster_url: Struct of the parsed url supplied by the user.
  * url: Full url used to find the remote file (supplied by user).
  * debug: Whether to log additional debug information.
+ * transfer: Tuning options for the data transfer.
+ * conns: Connections to the volume.
  */
 struct state {
         struct gluster_url *gluster_url;
         struct xlator_option *xlator_options;
         char *url;
         bool debug;
+        struct transfer_options transfer;
+        struct transfer_connections conns;
 };
 
 static struct state *state;
 
 static struct option const long_options[] =
 {
+        {"block-size", required_argument, NULL, TRANSFER_OPTION_BLOCK_SIZE},
+        {"buffer-size", required_argument, NULL, TRANSFER_OPTION_BUFFER_SIZE},
+        {"buffers", required_argument, NULL, TRANSFER_OPTION_BUFFERS},
+        {"bwlimit", required_argument, NULL, TRANSFER_OPTION_BWLIMIT},
+        {"connections", required_argument, NULL, TRANSFER_OPTION_CONNECTIONS},
         {"debug", no_argument, NULL, 'd'},
+        {"direct", no_argument, NULL, TRANSFER_OPTION_DIRECT},
         {"help", no_argument, NULL, 'x'},
+        {"huge-pages", no_argument, NULL, TRANSFER_OPTION_HUGE_PAGES},
+        {"io-uring", no_argument, NULL, TRANSFER_OPTION_IO_URING},
+        {"iops-limit", required_argument, NULL, TRANSFER_OPTION_IOPS_LIMIT},
+        {"mmap", no_argument, NULL, TRANSFER_OPTION_MMAP},
         {"port", required_argument, NULL, 'p'},
+        {"queue-depth", required_argument, NULL, TRANSFER_OPTION_QUEUE_DEPTH},
+        {"stats", required_argument, NULL, TRANSFER_OPTION_STATS},
+        {"stats-interval", required_argument, NULL, TRANSFER_OPTION_STATS_INTERVAL},
+        {"target-latency", required_argument, NULL, TRANSFER_OPTION_TARGET_LATENCY},
         {"version", no_argument, NULL, 'v'},
         {"xlator-option", required_argument, NULL, 'o'},
         {NULL, no_argument, NULL, 0}
@@ -65,6 +84,8 @@ static struct option const long_options[] =
 static int
 gluster_get (glfs_t *fs, const char *filename) {
         glfs_fd_t *fd = NULL;
+        struct transfer_endpoint source;
+        struct transfer_endpoint dest;
         int ret = -1;
 
         fd = glfs_open (fs, filename, O_RDONLY);
@@ -80,7 +101,18 @@ gluster_get (glfs_t *fs, const char *filename) {
                 goto out;
         }
 
-        if ((ret = gluster_read (fd, STDOUT_FILENO)) == -1) {
+        transfer_gluster (&source, fd);
+        transfer_local (&dest, STDOUT_FILENO);
+
+        ret = transfer_open_connections (&source, &state->conns, filename, O_RDONLY);
+        if (ret == -1) {
+                error (0, errno, "%s", state->url);
+                goto out;
+        }
+
+        ret = transfer (&source, &dest, &state->transfer);
+        transfer_close_connections (&source);
+        if (ret == -1) {
                 error (0, errno, "write error");
                 goto out;
         }
@@ -107,7 +139,47 @@ usage ()
                 "  -o, --xlator-option=OPTION   specify a translator option for the\n"
                 "                               connection. Multiple options are supported\n"
                 "                               and take the form xlator.key=value.\n"
+                "      --block-size=SIZE        read and write SIZE bytes at a time; SIZE\n"
+                "                               may end in K or M. With 'auto', start\n"
+                "                               from the layout of the files and adjust\n"
+                "                               it to the measured throughput (default:\n"
+                "                               the buffer size)\n"
+                "      --buffer-size=SIZE       use buffers of SIZE bytes, at least the\n"
+                "                               block size (default: 256K, or 4M with\n"
+                "                               --block-size=auto)\n"
+                "      --buffers=N              use N buffers of that size per transfer\n"
+                "                               (default: twice the queue depth, at\n"
+                "                               least 4)\n"
+                "      --bwlimit=RATE           read no more than RATE bytes per second\n"
+                "                               in all; RATE may end in K, M or G\n"
+                "      --connections=N          open N connections to the Gluster volume\n"
+                "                               and spread the reads across them\n"
+                "                               (default: 1)\n"
+                "      --direct                 keep a regular file that standard output\n"
+                "                               is redirected to out of the page cache,\n"
+                "                               with O_DIRECT where the file system\n"
+                "                               allows it\n"
+                "      --huge-pages             back large buffers with transparent huge\n"
+                "                               pages\n"
+                "      --io-uring               read and write local files through\n"
+                "                               io_uring, with up to the queue depth of\n"
+                "                               fops in flight\n"
+                "      --iops-limit=N           issue no more than N reads and writes\n"
+                "                               per second in all\n"
+                "      --mmap                   write standard output straight into the\n"
+                "                               memory of a regular file that it was\n"
+                "                               opened for reading and writing (<>)\n"
                 "  -p, --port=PORT              specify the port on which to connect\n"
+                "      --queue-depth=N          keep up to N reads in flight on the\n"
+                "                               Gluster volume (default: 1)\n"
+                "      --stats=FORMAT           report transfer statistics on standard\n"
+                "                               error when done, as 'text' or 'json'\n"
+                "      --stats-interval=N       also report them every N seconds\n"
+                "      --target-latency=TIME    adjust the number of reads and writes in\n"
+                "                               flight on Gluster, up to what\n"
+                "                               --queue-depth allows, to keep each of them\n"
+                "                               within TIME; TIME may end in us, ms or s\n"
+                "                               (default unit: ms)\n"
                 "      --help     display this help and exit\n"
                 "      --version  output version information and exit\n\n"
                 "Examples:\n"
@@ -163,6 +235,25 @@ parse_options (int argc, char *argv[], bool has_connection)
                                         goto out;
                                 }
 
+                                break;
+                        case TRANSFER_OPTION_BLOCK_SIZE:
+                        case TRANSFER_OPTION_BUFFER_SIZE:
+                        case TRANSFER_OPTION_BUFFERS:
+                        case TRANSFER_OPTION_BWLIMIT:
+                        case TRANSFER_OPTION_CONNECTIONS:
+                        case TRANSFER_OPTION_DIRECT:
+                        case TRANSFER_OPTION_HUGE_PAGES:
+                        case TRANSFER_OPTION_IO_URING:
+                        case TRANSFER_OPTION_IOPS_LIMIT:
+                        case TRANSFER_OPTION_MMAP:
+                        case TRANSFER_OPTION_QUEUE_DEPTH:
+                        case TRANSFER_OPTION_STATS:
+                        case TRANSFER_OPTION_STATS_INTERVAL:
+                        case TRANSFER_OPTION_TARGET_LATENCY:
+                                if (parse_transfer_option (opt, optarg, &state->transfer) == -1) {
+                                        goto out;
+                                }
+
                                 break;
                         case 'v':
                                 printf ("%s (%s) %s\n%s\n%s\n%s\n",
@@ -183,7 +274,7 @@ parse_options (int argc, char *argv[], bool has_connection)
                 }
         }
 
-        if ((argc - option_index) < 2) {
+        if ((argc - optind) < 1) {
                 error (0, 0, "missing operand");
                 goto err;
         } else {
@@ -240,6 +331,8 @@ init_state ()
         state->gluster_url = NULL;
         state->url = NULL;
         state->xlator_options = NULL;
+        state->conns.count = 0;
+        transfer_options_init (&state->transfer);
 
 out:
         return state;
@@ -272,6 +365,15 @@ cat_without_context ()
                 }
         }
 
+        ret = gluster_getfs_connections (&state->conns, fs,
+                                         state->transfer.connections,
+                                         state->gluster_url,
+                                         &state->xlator_options);
+        if (ret == -1) {
+                error (0, errno, "%s", state->url);
+                goto out;
+        }
+
         ret = gluster_get (fs, state->gluster_url->path);
         if (ret == -1) {
                 goto out;
@@ -280,6 +382,8 @@ cat_without_context ()
         ret = 0;
 
 out:
+        gluster_fini_connections (&state->conns);
+
         if (fs) {
                 glfs_fini (fs);
         }
@@ -306,7 +410,29 @@ do_cat (struct cli_context *ctx)
                         goto out;
                 }
 
+                ret = gluster_getfs_connections (&state->conns, ctx->fs,
+                                                 state->transfer.connections,
+                                                 ctx->url,
+                                                 &ctx->options->xlator_options);
+                if (ret == -1) {
+                        error (0, errno, "%s", ctx->conn_str);
+                        goto out;
+                }
+
+                ret = transfer_stats_start (state->transfer.stats,
+                                            state->transfer.stats_interval);
+                if (ret == -1) {
+                        error (0, errno, "failed to start transfer statistics");
+                        gluster_fini_connections (&state->conns);
+                        goto out;
+                }
+
+                transfer_limit_set (state->transfer.bwlimit, state->transfer.iops_limit,
+                                    state->transfer.target_latency);
+
                 ret = gluster_get (ctx->fs, state->gluster_url->path);
+                transfer_stats_stop ();
+                gluster_fini_connections (&state->conns);
         } else {
                 state->debug = ctx->options->debug;
                 ret = parse_options (argc, argv, false);
@@ -318,7 +444,18 @@ do_cat (struct cli_context *ctx)
                                 goto out;
                 }
 
+                ret = transfer_stats_start (state->transfer.stats,
+                                            state->transfer.stats_interval);
+                if (ret == -1) {
+                        error (0, errno, "failed to start transfer statistics");
+                        goto out;
+                }
+
+                transfer_limit_set (state->transfer.bwlimit, state->transfer.iops_limit,
+                                    state->transfer.target_latency);
+
                 ret = cat_without_context ();
+                transfer_stats_stop ();
         }
 
 out:
@@ -375,6 +375,7 @@ cleanup ()
                 ctx->fs = NULL;
         }
 
+        buffer_pool_drain ();
         free (ctx);
 }
 
@@ -22,24 +22,28 @@
 #include <config.h>
 
 #include "glfs-cp.h"
+#include "glfs-transfer.h"
 #include "glfs-util.h"
+#include "glfs-walk.h"
 
+#include <dirent.h>
 #include <errno.h>
 #include <error.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <glusterfs/api/glfs.h>
 #include <linux/limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #define AUTHORS "Written by Craig Cabrey."
-#define BUFFER_SIZE 1024*1024
 
 /**
  * Represents the various transfer modes supported by gfcp.
@@ -58,6 +62,26 @@ enum transfer_mode {
         REMOTE_TO_REMOTE
 };
 
+/**
+ * A subvolume that files are copied from, and the number of them being
+ * copied from it right now.
+ */
+struct brick {
+        struct brick *next;
+        char *name;
+        unsigned int copies;
+};
+
+/**
+ * The subvolumes that the files of a copy of many files are on, so that no
+ * more than --brick-jobs of them are copied from any one of them at once.
+ */
+struct brick_table {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        struct brick *bricks;
+};
+
 /**
  * Used to store the state of the program, including user supplied options.
  *
@@ -67,6 +91,15 @@ enum transfer_mode {
  * source: Raw source string supplied by the user.
  * debug: Whether to log additional debug information.
  * mode: The detected transfer mode (deduced from the supplied source and dest).
+ * transfer: Tuning options for the data transfer.
+ * source_conns/dest_conns: Connections to the source and destination volumes.
+ * recursive: Whether directories are copied along with what they hold.
+ * checksum_out: Stream that the checksums of the copied files are written to.
+ * from_list: Manifest of the sources and destinations to copy, if any.
+ * null_data: Whether the names in the manifest end with NUL, not newline.
+ * port: Port to connect to the volumes in the manifest on.
+ * sources/nsources: The sources given, when there are more than one.
+ * bricks: The copies in progress on each subvolume, with --brick-jobs.
  */
 struct state {
         struct gluster_url *gluster_dest;
@@ -76,14 +109,48 @@ struct state {
         char *source;
         bool debug;
         enum transfer_mode mode;
+        struct transfer_options transfer;
+        struct transfer_connections source_conns;
+        struct transfer_connections dest_conns;
+        bool recursive;
+        FILE *checksum_out;
+        char *from_list;
+        bool null_data;
+        uint16_t port;
+        char **sources;
+        int nsources;
+        struct brick_table bricks;
 };
 
 static struct state *state;
 static struct option const long_options[] =
 {
+        {"block-size", required_argument, NULL, TRANSFER_OPTION_BLOCK_SIZE},
+        {"brick-jobs", required_argument, NULL, TRANSFER_OPTION_BRICK_JOBS},
+        {"buffer-size", required_argument, NULL, TRANSFER_OPTION_BUFFER_SIZE},
+        {"buffers", required_argument, NULL, TRANSFER_OPTION_BUFFERS},
+        {"bwlimit", required_argument, NULL, TRANSFER_OPTION_BWLIMIT},
+        {"checksum-out", required_argument, NULL, TRANSFER_OPTION_CHECKSUM_OUT},
+        {"connections", required_argument, NULL, TRANSFER_OPTION_CONNECTIONS},
         {"debug", no_argument, NULL, 'd'},
+        {"delta", no_argument, NULL, TRANSFER_OPTION_DELTA},
+        {"direct", no_argument, NULL, TRANSFER_OPTION_DIRECT},
+        {"from-list", required_argument, NULL, 'T'},
         {"help", no_argument, NULL, 'x'},
+        {"huge-pages", no_argument, NULL, TRANSFER_OPTION_HUGE_PAGES},
+        {"io-uring", no_argument, NULL, TRANSFER_OPTION_IO_URING},
+        {"iops-limit", required_argument, NULL, TRANSFER_OPTION_IOPS_LIMIT},
+        {"jobs", required_argument, NULL, TRANSFER_OPTION_JOBS},
+        {"mmap", no_argument, NULL, TRANSFER_OPTION_MMAP},
+        {"null", no_argument, NULL, 'z'},
         {"port", required_argument, NULL, 'p'},
+        {"queue-depth", required_argument, NULL, TRANSFER_OPTION_QUEUE_DEPTH},
+        {"recursive", no_argument, NULL, 'r'},
+        {"resume", required_argument, NULL, TRANSFER_OPTION_RESUME},
+        {"stats", required_argument, NULL, TRANSFER_OPTION_STATS},
+        {"stats-interval", required_argument, NULL, TRANSFER_OPTION_STATS_INTERVAL},
+        {"target-latency", required_argument, NULL, TRANSFER_OPTION_TARGET_LATENCY},
+        {"verify", no_argument, NULL, TRANSFER_OPTION_VERIFY},
         {"version", no_argument, NULL, 'v'},
         {"xlator-option", required_argument, NULL, 'o'},
         {NULL, no_argument, NULL, 0}
@@ -118,14 +185,92 @@ static void
 usage ()
 {
         printf ("Usage: %s [OPTION]... SOURCE DEST\n"
-                "Copy SOURCE to DEST; one of local to remote, remote to local, or remote to remote.\n\n"
+                "  or:  %s [OPTION]... SOURCE... DIRECTORY\n"
+                "  or:  %s [OPTION]... --from-list=FILE\n"
+                "Copy SOURCE to DEST, or several SOURCEs into DIRECTORY; one of local to remote,\n"
+                "remote to local, or remote to remote.\n"
+                "With --from-list, copy each SOURCE and DEST pair listed in FILE instead.\n\n"
                 "  -o, --xlator-option=OPTION   specify a translator option for the\n"
                 "                               connection. Multiple options are supported\n"
                 "                               and take the form xlator.key=value.\n"
                 "                               In the case of both the source and the\n"
                 "                               destination being Gluster URLs, the options\n"
                 "                               will be applied to both connections.\n"
+                "      --block-size=SIZE        read and write SIZE bytes at a time; SIZE\n"
+                "                               may end in K or M. With 'auto', start\n"
+                "                               from the layout of the files and adjust\n"
+                "                               it to the measured throughput (default:\n"
+                "                               the buffer size)\n"
+                "      --brick-jobs=N           with -r, --from-list or several SOURCEs,\n"
+                "                               copy no more than N files at once from\n"
+                "                               any one brick of a Gluster source, and\n"
+                "                               take the listed files from the bricks in\n"
+                "                               turns\n"
+                "      --buffer-size=SIZE       use buffers of SIZE bytes, at least the\n"
+                "                               block size (default: 256K, or 4M with\n"
+                "                               --block-size=auto)\n"
+                "      --buffers=N              use N buffers of that size per transfer\n"
+                "                               (default: twice the queue depth, at\n"
+                "                               least 4)\n"
+                "      --bwlimit=RATE           read no more than RATE bytes per second\n"
+                "                               in all; RATE may end in K, M or G\n"
+                "      --checksum-out=FILE      write the CRC32C of the copied data to FILE\n"
+                "      --connections=N          open N connections to each Gluster volume\n"
+                "                               and spread the transfer across them\n"
+                "                               (default: 1)\n"
+                "      --delta                  only write the blocks of a regular file\n"
+                "                               that differ from what the destination\n"
+                "                               already holds, read back to compare\n"
+                "      --direct                 keep local files out of the page cache:\n"
+                "                               read and write them with O_DIRECT where\n"
+                "                               the file system allows it, or else drop\n"
+                "                               their pages as the copy goes\n"
+                "  -T, --from-list=FILE         copy the pairs of SOURCE and DEST in FILE,\n"
+                "                               or standard input if FILE is -, one pair\n"
+                "                               per line with a tab in between, keeping\n"
+                "                               one connection to each volume for all of\n"
+                "                               them. The outcome of each pair is reported\n"
+                "                               on standard output, and the total\n"
+                "                               throughput on standard error\n"
+                "      --huge-pages             back large buffers with transparent huge\n"
+                "                               pages\n"
+                "      --io-uring               read and write local files through\n"
+                "                               io_uring, with up to the queue depth of\n"
+                "                               fops in flight\n"
+                "      --iops-limit=N           issue no more than N reads and writes\n"
+                "                               per second in all\n"
+                "      --jobs=N                 copy a regular file as N byte ranges at\n"
+                "                               once, each over its own file descriptors,\n"
+                "                               or with -r, --from-list or several\n"
+                "                               SOURCEs, N files at once (default: 1)\n"
+                "      --mmap                   map local files into memory for Gluster\n"
+                "                               to read from and write into directly. A\n"
+                "                               local file that shrinks meanwhile kills\n"
+                "                               the copy with SIGBUS\n"
                 "  -p, --port=PORT              specify the port on which to connect\n"
+                "      --queue-depth=N          keep up to N reads or writes in flight on\n"
+                "                               each Gluster volume (default: 1)\n"
+                "  -r, -R, --recursive          copy directories and everything in them,\n"
+                "                               keeping symbolic links as links\n"
+                "      --resume=JOURNAL         keep track of the progress of the copy of\n"
+                "                               a regular file in the local file JOURNAL,\n"
+                "                               and if it already exists, check what was\n"
+                "                               copied before and copy only the rest. The\n"
+                "                               journal is removed once the copy is done\n"
+                "      --stats=FORMAT           report transfer statistics on standard\n"
+                "                               error when done, as 'text' or 'json'\n"
+                "      --stats-interval=N       also report them every N seconds\n"
+                "      --target-latency=TIME    adjust the number of reads and writes in\n"
+                "                               flight on Gluster, up to what --jobs and\n"
+                "                               --queue-depth allow, to keep each of them\n"
+                "                               within TIME; TIME may end in us, ms or s\n"
+                "                               (default unit: ms)\n"
+                "      --verify                 read the destination back when done and\n"
+                "                               check it against the CRC32C of the data\n"
+                "                               sent to it\n"
+                "  -z, --null                   end each SOURCE and DEST in the file given\n"
+                "                               to --from-list with NUL, not a tab or a\n"
+                "                               newline\n"
                 "      --help     display this help and exit\n"
                 "      --version  output version information and exit\n\n"
                 "Examples:\n"
@@ -144,7 +289,14 @@ usage ()
                 "       Gluster volume to a local file called example.\n"
                 "  gfcli (localhost/groot)> cp file://example glfs://host/volume/example\n"
                 "       Copy the local file example to a remote Gluster volume on the\n"
-                "       host 'host'.\n",
+                "       host 'host'.\n"
+                "  find /data -type f -printf '%%p\\tglfs://host/volume/%%P\\n' | gfcp -T -\n"
+                "       Copies every file below /data to the same place on a remote\n"
+                "       Gluster volume, over one connection.\n"
+                "  gfcp --jobs=4 *.log glfs://host/volume/logs/\n"
+                "       Copies every local file ending in .log into the directory logs\n"
+                "       on a remote Gluster volume, four at a time.\n",
+                program_invocation_name, program_invocation_name,
                 program_invocation_name);
 }
 
@@ -163,7 +315,7 @@ parse_options (int argc, char *argv[], bool has_connection)
         // Reset getopt as other utilities may have called it already.
         optind = 0;
         while (true) {
-                opt = getopt_long (argc, argv, "o:p:", long_options,
+                opt = getopt_long (argc, argv, "o:p:rRT:z", long_options,
                                 &option_index);
 
                 if (opt == -1) {
@@ -193,6 +345,46 @@ parse_options (int argc, char *argv[], bool has_connection)
                                         goto out;
                                 }
 
+                                break;
+                        case 'T':
+                                state->from_list = strdup (optarg);
+                                if (state->from_list == NULL) {
+                                        error (0, errno, "strdup");
+                                        goto out;
+                                }
+
+                                break;
+                        case 'r':
+                        case 'R':
+                                state->recursive = true;
+                                break;
+                        case 'z':
+                                state->null_data = true;
+                                break;
+                        case TRANSFER_OPTION_BLOCK_SIZE:
+                        case TRANSFER_OPTION_BRICK_JOBS:
+                        case TRANSFER_OPTION_BUFFER_SIZE:
+                        case TRANSFER_OPTION_BUFFERS:
+                        case TRANSFER_OPTION_BWLIMIT:
+                        case TRANSFER_OPTION_CHECKSUM_OUT:
+                        case TRANSFER_OPTION_CONNECTIONS:
+                        case TRANSFER_OPTION_DELTA:
+                        case TRANSFER_OPTION_DIRECT:
+                        case TRANSFER_OPTION_HUGE_PAGES:
+                        case TRANSFER_OPTION_IO_URING:
+                        case TRANSFER_OPTION_IOPS_LIMIT:
+                        case TRANSFER_OPTION_JOBS:
+                        case TRANSFER_OPTION_MMAP:
+                        case TRANSFER_OPTION_QUEUE_DEPTH:
+                        case TRANSFER_OPTION_RESUME:
+                        case TRANSFER_OPTION_STATS:
+                        case TRANSFER_OPTION_STATS_INTERVAL:
+                        case TRANSFER_OPTION_TARGET_LATENCY:
+                        case TRANSFER_OPTION_VERIFY:
+                                if (parse_transfer_option (opt, optarg, &state->transfer) == -1) {
+                                        goto out;
+                                }
+
                                 break;
                         case 'v':
                                 printf ("%s (%s) %s\n%s\n%s\n%s\n",
@@ -213,9 +405,42 @@ parse_options (int argc, char *argv[], bool has_connection)
                 }
         }
 
-        if ((argc - option_index) < 3) {
+        if (state->recursive && state->transfer.journal) {
+                error (0, 0, "--resume cannot be used with --recursive");
+                goto err;
+        }
+
+        if (state->from_list) {
+                if (state->transfer.journal) {
+                        error (0, 0, "--resume cannot be used with --from-list");
+                        goto err;
+                }
+
+                if (optind < argc) {
+                        error (0, 0, "extra operand '%s'", argv[optind]);
+                        goto err;
+                }
+
+                state->port = port;
+                ret = 0;
+                goto out;
+        }
+
+        if ((argc - optind) < 2) {
                 error (0, 0, "missing operand");
                 goto err;
+        } else if ((argc - optind) > 2) {
+                // Several sources are copied into the directory named last,
+                // each on whichever side its name says, as with --from-list.
+                state->dest = strdup (argv[argc - 1]);
+                if (state->dest == NULL) {
+                        error (0, errno, "strdup");
+                        goto out;
+                }
+
+                state->sources = &argv[optind];
+                state->nsources = argc - optind - 1;
+                state->port = port;
         } else {
                 /*
                  * The following block of code parses the source and destination
@@ -465,6 +690,19 @@ init_state ()
         state->gluster_source = NULL;
         state->source = NULL;
         state->xlator_options = NULL;
+        state->source_conns.count = 0;
+        state->dest_conns.count = 0;
+        state->recursive = false;
+        state->checksum_out = NULL;
+        state->from_list = NULL;
+        state->null_data = false;
+        state->port = GLUSTER_DEFAULT_PORT;
+        state->sources = NULL;
+        state->nsources = 0;
+        pthread_mutex_init (&state->bricks.lock, NULL);
+        pthread_cond_init (&state->bricks.cond, NULL);
+        state->bricks.bricks = NULL;
+        transfer_options_init (&state->transfer);
 
 out:
         return state;
@@ -523,67 +761,285 @@ out:
 }
 
 /**
- * Perform a LOCAL_TO_REMOTE transfer, given the local source and remote
- * destination, and an active connection to the remote destination.
+ * Reads back dest, already written, to check it against the checksum expected
+ * of the data that was copied into it, and records that checksum, as asked for.
  */
 static int
-local_to_remote (const char *local_path, const char *remote_path, glfs_t *fs)
+finish_checksum (struct transfer_endpoint *dest, const struct transfer_file *dest_file,
+                 const struct transfer_options *options, uint32_t expected)
 {
-        int ret = -1;
-        int fd;
-        glfs_fd_t *remote_fd = NULL;
         struct stat statbuf;
-        char *full_path = NULL;
+        uint32_t crc;
+        int ret;
 
-        fd = open (local_path, O_RDONLY);
-        if (fd == -1) {
-                error (0, errno, "%s", local_path);
-                goto out;
+        if (options->verify) {
+                if (dest->type == TRANSFER_GLUSTER) {
+                        ret = glfs_fstat (dest->glfd, &statbuf);
+                } else {
+                        ret = fstat (dest->fd, &statbuf);
+                }
+
+                if (ret == -1) {
+                        return -1;
+                }
+
+                if (!S_ISREG (statbuf.st_mode)) {
+                        error (0, 0, "%s: cannot verify a destination that is not a "
+                               "regular file", dest_file->path);
+                        errno = EINVAL;
+                        return -1;
+                }
+
+                ret = transfer_checksum (dest_file, 0, statbuf.st_size,
+                                         options, &crc);
+                if (ret == -1) {
+                        return -1;
+                }
+
+                if (crc != expected) {
+                        error (0, 0, "%s: checksum mismatch", dest_file->path);
+                        errno = EIO;
+                        return -1;
+                }
+        }
+
+        if (state->checksum_out) {
+                ret = transfer_write_checksum (state->checksum_out,
+                                               dest_file->path, expected);
+                if (ret == -1) {
+                        error (0, errno, "%s", state->transfer.checksum_file);
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+/**
+ * Whether many files are copied at once, as for a recursive copy, a manifest
+ * or several sources, in which case each file is copied by a single job over
+ * a single connection.
+ */
+static bool
+many_at_once ()
+{
+        return state->recursive || state->from_list || state->sources;
+}
+
+/**
+ * Copies the data of the already opened source into dest. A Gluster side
+ * comes with the connections to its volume; local sides pass NULL.
+ *
+ * A copy within one volume is left to the bricks where libgfapi allows it.
+ * Otherwise, a regular file as the source is copied as several byte ranges at
+ * once over fds of their own with more than one job or as a delta, and extent
+ * by extent when it has holes. Anything else is streamed, with the asynchronous fops
+ * spread across the connections, into a destination preallocated to the
+ * source size when it is known.
+ *
+ * A checksum, when asked for, is taken of the data on its way through, so a
+ * copy within one volume is made by the client then, as is a resumable copy,
+ * which the journal keeps the ranges of, and a delta copy, which has to
+ * compare every block with the destination.
+ */
+static int
+copy_data (struct transfer_endpoint *source,
+           const struct transfer_connections *source_conns, const char *source_path,
+           struct transfer_endpoint *dest,
+           const struct transfer_connections *dest_conns, const char *dest_path)
+{
+        struct transfer_file source_file = { source->type, source_conns, source_path };
+        struct transfer_file dest_file = { dest->type, dest_conns, dest_path };
+        struct transfer_options options = state->transfer;
+        struct transfer_journal journal;
+        struct stat statbuf;
+        uint32_t crc = 0;
+        int ret;
+
+        if (options.verify || options.checksum_file) {
+                options.checksum = &crc;
+        }
+
+        if (many_at_once ()) {
+                options.jobs = 1;
+        }
+
+        if (source_conns && dest_conns && source_conns->fs[0] == dest_conns->fs[0]
+                        && options.checksum == NULL
+                        && options.journal == NULL
+                        && !options.delta) {
+                ret = transfer_server_copy (source, dest);
+                if (ret == 0 || (errno != ENOSYS && errno != EOPNOTSUPP
+                                        && errno != EXDEV)) {
+                        return ret;
+                }
         }
 
-        ret = glfs_lstat (fs, remote_path, &statbuf);
+        if (source->type == TRANSFER_GLUSTER) {
+                ret = glfs_fstat (source->glfd, &statbuf);
+        } else {
+                ret = fstat (source->fd, &statbuf);
+        }
 
         if (ret == -1) {
-                full_path = complete_path (local_path, remote_path, NULL);
+                return -1;
+        }
+
+        if (options.journal && !S_ISREG (statbuf.st_mode)) {
+                error (0, 0, "%s: only the copy of a regular file can be resumed",
+                       source_path);
+                errno = EINVAL;
+                return -1;
+        }
+
+        if (options.delta && !S_ISREG (statbuf.st_mode)) {
+                error (0, 0, "%s: only a regular file can be copied as a delta",
+                       source_path);
+                errno = EINVAL;
+                return -1;
+        }
+
+        if (options.journal) {
+                ret = transfer_journal_open (&journal, options.journal,
+                                             &statbuf, &options);
+                if (ret == -1) {
+                        error (0, errno, "%s", options.journal);
+                        return -1;
+                }
+
+                ret = transfer_resume (&source_file, &dest_file, &statbuf,
+                                       &options, &journal);
+                if (ret == 0 && options.checksum) {
+                        ret = finish_checksum (dest, &dest_file, &options, crc);
+                }
+
+                transfer_journal_close (&journal, ret == 0);
+                return ret;
+        }
+
+        if (S_ISREG (statbuf.st_mode)
+                        && (options.jobs > 1 || options.delta)) {
+                ret = transfer_parallel (&source_file, &dest_file,
+                                         &statbuf, &options);
+                goto out;
+        }
+
+        if (source_conns && !many_at_once ()) {
+                ret = transfer_open_connections (source, source_conns,
+                                                 source_path, O_RDONLY);
+                if (ret == -1) {
+                        return -1;
+                }
+        }
+
+        if (dest_conns && !many_at_once ()) {
+                ret = transfer_open_connections (dest, dest_conns,
+                                                 dest_path, O_WRONLY);
+                if (ret == -1) {
+                        transfer_close_connections (source);
+                        return -1;
+                }
+        }
+
+        if (S_ISREG (statbuf.st_mode) && transfer_is_sparse (&statbuf)) {
+                ret = transfer_sparse (source, dest, &statbuf, &options);
+        } else if (S_ISREG (statbuf.st_mode)) {
+                ret = transfer_preallocate (dest, 0, statbuf.st_size);
+                if (ret == 0) {
+                        ret = transfer (source, dest, &options);
+                }
         } else {
-                full_path = complete_path (local_path, remote_path, &statbuf);
+                ret = transfer (source, dest, &options);
         }
 
-        if (full_path == NULL) {
-                ret = -1;
+        transfer_close_connections (source);
+        transfer_close_connections (dest);
+
+out:
+        if (ret == 0 && options.checksum) {
+                ret = finish_checksum (dest, &dest_file, &options, crc);
+        }
+
+        return ret;
+}
+
+/**
+ * Opens the connections to a volume asked for with --connections, next to
+ * the already established connection fs.
+ */
+static int
+connect_volume (struct transfer_connections *conns, glfs_t *fs,
+                const struct gluster_url *gluster_url,
+                struct xlator_option **xlator_options, const char *url)
+{
+        int ret;
+
+        ret = gluster_getfs_connections (conns, fs, state->transfer.connections,
+                                         gluster_url, xlator_options);
+        if (ret == -1) {
+                error (0, errno, "%s", url);
+        }
+
+        return ret;
+}
+
+/**
+ * Perform a LOCAL_TO_REMOTE transfer, given the local source and remote
+ * destination, and an active connection to the remote destination.
+ */
+static int
+local_to_remote (const char *local_path, const char *remote_path, glfs_t *fs,
+                 const struct transfer_connections *conns)
+{
+        int ret = -1;
+        int fd;
+        glfs_fd_t *remote_fd = NULL;
+        struct transfer_endpoint source;
+        struct transfer_endpoint dest;
+
+        fd = open (local_path, O_RDONLY);
+        if (fd == -1) {
+                error (0, errno, "%s", local_path);
                 goto out;
         }
 
-        remote_fd = glfs_creat (fs, full_path, O_RDWR, get_default_file_mode_perm ());
+        remote_fd = glfs_creat (fs, remote_path, O_RDWR, get_default_file_mode_perm ());
         if (remote_fd == NULL) {
-                error (0, errno, "failed to create %s", full_path);
+                error (0, errno, "failed to create %s", remote_path);
                 ret = -1;
                 goto out;
         }
 
         ret = gluster_lock (remote_fd, F_WRLCK, false);
         if (ret == -1) {
-                error (0, errno, "failed to lock %s", full_path);
+                error (0, errno, "failed to lock %s", remote_path);
                 goto out;
         }
+
+        // A resumed copy keeps what made it to the destination last time,
+        // and a delta copy what it can of what was there before.
+        if (state->transfer.journal == NULL && !state->transfer.delta) {
 #ifdef HAVE_GLFS_7_6
-        ret = glfs_ftruncate (remote_fd, 0, NULL, NULL);
+                ret = glfs_ftruncate (remote_fd, 0, NULL, NULL);
 #else
-        ret = glfs_ftruncate (remote_fd, 0);
+                ret = glfs_ftruncate (remote_fd, 0);
 #endif
-        if (ret == -1) {
-                error (0, errno, "failed to truncate %s", full_path);
-                goto out;
+                if (ret == -1) {
+                        error (0, errno, "failed to truncate %s", remote_path);
+                        goto out;
+                }
         }
 
-        if (gluster_write (fd, remote_fd) == 0) {
-                ret = -1;
+        transfer_local (&source, fd);
+        transfer_gluster (&dest, remote_fd);
+
+        ret = copy_data (&source, NULL, local_path,
+                         &dest, conns, remote_path);
+        if (ret == -1) {
                 error (0, errno, "failed to transfer %s", local_path);
         }
 
 out:
-        free (full_path);
-
         if (fd != -1) {
                 close (fd);
         }
@@ -600,25 +1056,14 @@ out:
  * destination, and an active connection to the remote source.
  */
 static int
-remote_to_local (const char *remote_path, const char *local_path, glfs_t *fs)
+remote_to_local (const char *remote_path, const char *local_path, glfs_t *fs,
+                 const struct transfer_connections *conns)
 {
         int ret = -1;
         int local_fd = -1;
         glfs_fd_t *remote_fd = NULL;
-        struct stat statbuf;
-        char *full_path;
-
-        ret = stat (local_path, &statbuf);
-        if (ret == -1) {
-                full_path = complete_path (remote_path, local_path, NULL);
-        } else {
-                full_path = complete_path (remote_path, local_path, &statbuf);
-        }
-
-        if (full_path == NULL) {
-                ret = -1;
-                goto out;
-        }
+        struct transfer_endpoint source;
+        struct transfer_endpoint dest;
 
         remote_fd = glfs_open (fs, remote_path, O_RDONLY);
         if (remote_fd == NULL) {
@@ -626,9 +1071,11 @@ remote_to_local (const char *remote_path, const char *local_path, glfs_t *fs)
                 goto out;
         }
 
-        local_fd = open (full_path, O_CREAT | O_WRONLY, get_default_file_mode_perm ());
+        // A mapping can't be written to through a write-only fd.
+        local_fd = open (local_path, O_CREAT | (state->transfer.mmap ? O_RDWR : O_WRONLY),
+                         get_default_file_mode_perm ());
         if (local_fd == -1) {
-                error (0, errno, "%s", full_path);
+                error (0, errno, "%s", local_path);
                 goto out;
         }
 
@@ -638,13 +1085,16 @@ remote_to_local (const char *remote_path, const char *local_path, glfs_t *fs)
                 goto out;
         }
 
-        if ((ret = gluster_read (remote_fd, local_fd)) == -1) {
+        transfer_gluster (&source, remote_fd);
+        transfer_local (&dest, local_fd);
+
+        ret = copy_data (&source, conns, remote_path,
+                         &dest, NULL, local_path);
+        if (ret == -1) {
                 error (0, errno, "write error");
         }
 
 out:
-        free (full_path);
-
         if (local_fd != -1) {
                 close (local_fd);
         }
@@ -661,29 +1111,15 @@ out:
  * paths and active connections to both the source and destination.
  */
 static int
-remote_to_remote (const char *source_path, const char *dest_path, glfs_t *source_fs, glfs_t *dest_fs)
+remote_to_remote (const char *source_path, const char *dest_path, glfs_t *source_fs,
+                  const struct transfer_connections *source_conns, glfs_t *dest_fs,
+                  const struct transfer_connections *dest_conns)
 {
         int ret = -1;
-        size_t num_read = 0;
-        size_t num_written = 0;
         glfs_fd_t *source_fd = NULL;
         glfs_fd_t *dest_fd = NULL;
-        struct stat statbuf;
-        char buf[BUFFER_SIZE];
-        char *full_path;
-
-        ret = glfs_lstat (dest_fs, dest_path, &statbuf);
-
-        if (ret == -1) {
-                full_path = complete_path (source_path, dest_path, NULL);
-        } else {
-                full_path = complete_path (source_path, dest_path, &statbuf);
-        }
-
-        if (full_path == NULL) {
-                ret = -1;
-                goto out;
-        }
+        struct transfer_endpoint source;
+        struct transfer_endpoint dest;
 
         source_fd = glfs_open (source_fs, source_path, O_RDONLY);
         if (source_fd == NULL) {
@@ -691,39 +1127,22 @@ remote_to_remote (const char *source_path, const char *dest_path, glfs_t *source
                 goto out;
         }
 
-        dest_fd = glfs_creat (dest_fs, full_path, O_CREAT | O_WRONLY, get_default_file_mode_perm ());
+        dest_fd = glfs_creat (dest_fs, dest_path, O_CREAT | O_WRONLY, get_default_file_mode_perm ());
         if (dest_fd == NULL) {
-                error (0, errno, "%s", full_path);
+                error (0, errno, "%s", dest_path);
                 goto out;
         }
 
-        while (true) {
-                num_read = glfs_read (source_fd, buf, BUFFER_SIZE, 0);
-                if (num_read == -1) {
-                        ret = -1;
-                        goto out;
-                }
-
-                if (num_read == 0) {
-                        goto out;
-                }
-
-                for (num_written = 0; num_written < num_read;) {
-                        ret = glfs_write (dest_fd,
-                                        &buf[num_written],
-                                        num_read - num_written, 0);
-                        if (ret == -1) {
-                                error (0, errno, "write error");
-                                goto out;
-                        }
+        transfer_gluster (&source, source_fd);
+        transfer_gluster (&dest, dest_fd);
 
-                        num_written += ret;
-                }
+        ret = copy_data (&source, source_conns, source_path,
+                         &dest, dest_conns, dest_path);
+        if (ret == -1) {
+                error (0, errno, "write error");
         }
 
 out:
-        free (full_path);
-
         if (source_fd) {
                 glfs_close (source_fd);
         }
@@ -735,62 +1154,1534 @@ out:
         return ret;
 }
 
-static int
-cp_without_context ()
+/**
+ * One side of a copy: a connection to a Gluster volume, along with all the
+ * connections to that volume, or the local file system if fs is NULL.
+ */
+struct side {
+        glfs_t *fs;
+        const struct transfer_connections *conns;
+};
+
+/**
+ * Waits until fewer than --brick-jobs files are being copied from the
+ * subvolume named name, and counts one more. Returns the subvolume, to be
+ * handed to leave_brick () once the copy is done, or NULL if it can't be
+ * tracked, in which case the file is copied anyway.
+ */
+static struct brick *
+enter_brick (struct brick_table *table, const char *name)
 {
-        glfs_t *dest_fs = NULL;
-        glfs_t *source_fs = NULL;
-        int ret = -1;
+        struct brick *brick;
 
-        switch (state->mode) {
-                case LOCAL_TO_REMOTE:
-                        ret = gluster_getfs (&dest_fs, state->gluster_dest);
-                        if (ret == -1) {
-                                error (0, errno, "%s", state->dest);
-                                goto out;
-                        }
+        pthread_mutex_lock (&table->lock);
+        for (brick = table->bricks; brick; brick = brick->next) {
+                if (strcmp (brick->name, name) == 0) {
+                        break;
+                }
+        }
 
-                        ret = apply_xlator_options (dest_fs, &state->xlator_options);
-                        if (ret == -1) {
-                                error (0, errno, "failed to apply translator options");
-                                goto out;
-                        }
+        if (brick == NULL) {
+                brick = calloc (1, sizeof (*brick));
+                if (brick && (brick->name = strdup (name)) == NULL) {
+                        free (brick);
+                        brick = NULL;
+                }
 
-                        ret = local_to_remote (state->source,
-                                                state->gluster_dest->path,
-                                                dest_fs);
-                        if (ret == -1) {
-                                goto out;
-                        }
+                if (brick == NULL) {
+                        goto out;
+                }
 
-                        break;
-                case REMOTE_TO_LOCAL:
-                        ret = gluster_getfs (&source_fs, state->gluster_source);
-                        if (ret == -1) {
-                                error (0, errno, "%s", state->source);
-                                goto out;
-                        }
+                brick->next = table->bricks;
+                table->bricks = brick;
+        }
 
-                        ret = apply_xlator_options (source_fs, &state->xlator_options);
-                        if (ret == -1) {
-                                error (0, errno, "failed to apply translator options");
-                                goto out;
-                        }
+        while (brick->copies >= state->transfer.brick_jobs) {
+                pthread_cond_wait (&table->cond, &table->lock);
+        }
 
-                        ret = remote_to_local (state->gluster_source->path,
-                                                state->dest,
-                                                source_fs);
-                        if (ret == -1) {
-                                goto out;
-                        }
+        brick->copies++;
 
-                        break;
-                case REMOTE_TO_REMOTE:
-                        ret = gluster_getfs (&dest_fs, state->gluster_dest);
-                        if (ret == -1) {
-                                error (0, errno, "%s", state->dest);
-                                goto out;
-                        }
+out:
+        pthread_mutex_unlock (&table->lock);
+
+        return brick;
+}
+
+static void
+leave_brick (struct brick_table *table, struct brick *brick)
+{
+        if (brick == NULL) {
+                return;
+        }
+
+        pthread_mutex_lock (&table->lock);
+        brick->copies--;
+        pthread_cond_broadcast (&table->cond);
+        pthread_mutex_unlock (&table->lock);
+}
+
+static void
+destroy_bricks (struct brick_table *table)
+{
+        struct brick *brick;
+
+        while ((brick = table->bricks) != NULL) {
+                table->bricks = brick->next;
+                free (brick->name);
+                free (brick);
+        }
+
+        pthread_cond_destroy (&table->cond);
+        pthread_mutex_destroy (&table->lock);
+}
+
+/**
+ * Copies the file at source_path to exactly dest_path, in whichever mode the
+ * two sides call for. With --brick-jobs, a file copied from Gluster as one of
+ * many waits for its turn on the subvolume it is on, named by brick if that
+ * is known already. The subvolume of a file uploaded isn't known before it is
+ * created, so uploads are left alone.
+ */
+static int
+copy_file (const char *source_path, const char *dest_path,
+           const struct side *source, const struct side *dest, const char *brick)
+{
+        struct brick *entered = NULL;
+        char *name = NULL;
+        int ret;
+
+        if (state->transfer.brick_jobs > 0 && source->fs && many_at_once ()) {
+                if (brick == NULL) {
+                        brick = name = gluster_get_subvolume (source->fs, source_path);
+                }
+
+                if (brick) {
+                        entered = enter_brick (&state->bricks, brick);
+                }
+        }
+
+        if (source->fs && dest->fs) {
+                ret = remote_to_remote (source_path, dest_path, source->fs,
+                                        source->conns, dest->fs, dest->conns);
+        } else if (source->fs) {
+                ret = remote_to_local (source_path, dest_path, source->fs,
+                                       source->conns);
+        } else {
+                ret = local_to_remote (source_path, dest_path, dest->fs, dest->conns);
+        }
+
+        leave_brick (&state->bricks, entered);
+        free (name);
+
+        return ret;
+}
+
+/**
+ * A file or directory still to be copied by a recursive copy, with the mode,
+ * inode and link count that the walk found it with.
+ */
+struct entry {
+        char *source;
+        char *dest;
+        mode_t mode;
+        dev_t dev;
+        ino_t ino;
+        nlink_t nlink;
+};
+
+enum inode_state {
+        INODE_COPYING,
+        INODE_COPIED,
+        INODE_FAILED
+};
+
+/**
+ * A source file with more than one name, by its inode, which libgfapi derives
+ * from the gfid on a Gluster side, and the name it was first copied to.
+ */
+struct inode {
+        dev_t dev;
+        ino_t ino;
+        char *dest;
+        enum inode_state state;
+};
+
+/**
+ * The files with more than one name seen so far by a recursive copy, in an
+ * open addressing hash table, so that every further name of one of them can
+ * be linked to its first copy instead of being copied again.
+ */
+struct inode_table {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        struct inode *inodes;
+        size_t size;
+        size_t count;
+};
+
+/**
+ * The two sides of a recursive copy. The workers take turns over the
+ * connections of a Gluster side.
+ */
+struct tree {
+        struct side source;
+        struct side dest;
+        struct inode_table inodes;
+};
+
+#define INODE_TABLE_SIZE 256
+
+static size_t
+hash_inode (dev_t dev, ino_t ino)
+{
+        uint64_t hash = (uint64_t) ino * 0x9e3779b97f4a7c15ULL;
+
+        return hash ^ (hash >> 32) ^ (uint64_t) dev;
+}
+
+/**
+ * Returns the slot of the inode dev/ino in table, which has a NULL dest if
+ * it isn't there yet. The table must be locked.
+ */
+static struct inode *
+find_inode (struct inode_table *table, dev_t dev, ino_t ino)
+{
+        size_t i = hash_inode (dev, ino) & (table->size - 1);
+
+        while (table->inodes[i].dest && (table->inodes[i].dev != dev
+                                         || table->inodes[i].ino != ino)) {
+                i = (i + 1) & (table->size - 1);
+        }
+
+        return &table->inodes[i];
+}
+
+/**
+ * Doubles the size of table, which must be locked.
+ */
+static int
+grow_inode_table (struct inode_table *table)
+{
+        struct inode *inodes = table->inodes;
+        size_t size = table->size;
+        struct inode *inode;
+        size_t i;
+
+        table->size = size ? size * 2 : INODE_TABLE_SIZE;
+        table->inodes = calloc (table->size, sizeof (*table->inodes));
+        if (table->inodes == NULL) {
+                table->inodes = inodes;
+                table->size = size;
+                return -1;
+        }
+
+        for (i = 0; i < size; i++) {
+                if (inodes[i].dest) {
+                        inode = find_inode (table, inodes[i].dev, inodes[i].ino);
+                        *inode = inodes[i];
+                }
+        }
+
+        free (inodes);
+
+        return 0;
+}
+
+static void
+init_inode_table (struct inode_table *table)
+{
+        pthread_mutex_init (&table->lock, NULL);
+        pthread_cond_init (&table->cond, NULL);
+        table->inodes = NULL;
+        table->size = 0;
+        table->count = 0;
+}
+
+static void
+destroy_inode_table (struct inode_table *table)
+{
+        size_t i;
+
+        for (i = 0; i < table->size; i++) {
+                free (table->inodes[i].dest);
+        }
+
+        free (table->inodes);
+        pthread_cond_destroy (&table->cond);
+        pthread_mutex_destroy (&table->lock);
+}
+
+/**
+ * Looks up the inode of entry in table. Returns NULL if entry is the first
+ * name of the inode seen, which is then the one to copy, and the name its
+ * copy went to otherwise, once that copy is done. An entry whose inode can't
+ * be tracked, or whose first copy failed, is copied on its own, as if it were
+ * the first name, but without a call to release_inode.
+ */
+static const char *
+claim_inode (struct inode_table *table, const struct entry *entry, bool *owner)
+{
+        struct inode *inode;
+        const char *dest = NULL;
+        char *copy;
+
+        *owner = false;
+
+        pthread_mutex_lock (&table->lock);
+        if (table->count * 2 >= table->size && grow_inode_table (table) == -1) {
+                goto out;
+        }
+
+        inode = find_inode (table, entry->dev, entry->ino);
+        if (inode->dest == NULL) {
+                copy = strdup (entry->dest);
+                if (copy) {
+                        inode->dev = entry->dev;
+                        inode->ino = entry->ino;
+                        inode->dest = copy;
+                        inode->state = INODE_COPYING;
+                        table->count++;
+                        *owner = true;
+                }
+
+                goto out;
+        }
+
+        // The table can grow while the first copy goes on, so the inode is
+        // looked up again every time.
+        while (inode->state == INODE_COPYING) {
+                pthread_cond_wait (&table->cond, &table->lock);
+                inode = find_inode (table, entry->dev, entry->ino);
+        }
+
+        if (inode->state == INODE_COPIED) {
+                dest = inode->dest;
+        }
+
+out:
+        pthread_mutex_unlock (&table->lock);
+
+        return dest;
+}
+
+/**
+ * Marks the first copy of the inode of entry as done, or as failed.
+ */
+static void
+release_inode (struct inode_table *table, const struct entry *entry, bool copied)
+{
+        struct inode *inode;
+
+        pthread_mutex_lock (&table->lock);
+        inode = find_inode (table, entry->dev, entry->ino);
+        inode->state = copied ? INODE_COPIED : INODE_FAILED;
+        pthread_cond_broadcast (&table->cond);
+        pthread_mutex_unlock (&table->lock);
+}
+
+/**
+ * Makes dest_path another name of target, already copied, replacing any file
+ * already in its way.
+ */
+static int
+link_file (const char *target, const char *dest_path, glfs_t *dest_fs)
+{
+        int ret;
+
+        if (dest_fs) {
+                ret = glfs_link (dest_fs, target, dest_path);
+                if (ret == -1 && errno == EEXIST && glfs_unlink (dest_fs, dest_path) == 0) {
+                        ret = glfs_link (dest_fs, target, dest_path);
+                }
+        } else {
+                ret = link (target, dest_path);
+                if (ret == -1 && errno == EEXIST && unlink (dest_path) == 0) {
+                        ret = link (target, dest_path);
+                }
+        }
+
+        if (ret == -1) {
+                error (0, errno, "cannot create hard link %s to %s", dest_path, target);
+        }
+
+        return ret;
+}
+
+/**
+ * Returns the side that worker should use in place of side, with one of the
+ * connections to its volume.
+ */
+static struct side
+worker_side (const struct side *side, unsigned int worker)
+{
+        struct side copy = *side;
+
+        if (side->fs && side->conns->count > 0) {
+                copy.fs = side->conns->fs[worker % side->conns->count];
+        }
+
+        return copy;
+}
+
+/**
+ * Returns a new entry for the paths source and dest, which it takes over, or
+ * NULL with errno set if either of them is missing or it can't be allocated.
+ */
+static struct entry *
+new_entry (char *source, char *dest, const struct stat *statbuf)
+{
+        struct entry *entry = NULL;
+
+        if (source && dest) {
+                entry = malloc (sizeof (*entry));
+        }
+
+        if (entry == NULL) {
+                free (source);
+                free (dest);
+                return NULL;
+        }
+
+        entry->source = source;
+        entry->dest = dest;
+        entry->mode = statbuf->st_mode;
+        entry->dev = statbuf->st_dev;
+        entry->ino = statbuf->st_ino;
+        entry->nlink = statbuf->st_nlink;
+
+        return entry;
+}
+
+static void
+free_entry (struct entry *entry)
+{
+        free (entry->source);
+        free (entry->dest);
+        free (entry);
+}
+
+/**
+ * Queues one entry of the directory being copied, which is named name and
+ * has the attributes in statbuf, for a worker to copy.
+ */
+static int
+queue_entry (struct walk *walk, unsigned int worker, const struct entry *dir,
+             const char *name, const struct stat *statbuf)
+{
+        struct entry *entry;
+
+        if (strcmp (name, ".") == 0 || strcmp (name, "..") == 0) {
+                return 0;
+        }
+
+        entry = new_entry (append_path (dir->source, name),
+                           append_path (dir->dest, name), statbuf);
+        if (entry == NULL) {
+                error (0, errno, "%s/%s", dir->source, name);
+                return -1;
+        }
+
+        if (walk_push (walk, worker, entry) == -1) {
+                error (0, errno, "%s", entry->source);
+                free_entry (entry);
+                return -1;
+        }
+
+        return 0;
+}
+
+/**
+ * Creates the destination of the directory entry, unless it exists already,
+ * and queues what the directory holds for the workers to copy.
+ */
+static int
+copy_directory (struct walk *walk, unsigned int worker, const struct entry *entry,
+                glfs_t *source_fs, glfs_t *dest_fs)
+{
+        glfs_fd_t *fd = NULL;
+        DIR *dir = NULL;
+        struct dirent *dirent;
+        struct stat statbuf;
+        uint64_t entered;
+        int ret;
+
+        // The fops of the walk itself are held to the target latency along
+        // with those of the copies, so that a wide tree is listed only as
+        // fast as the volume keeps up.
+        if (dest_fs) {
+                entered = transfer_limit_enter ();
+                ret = glfs_mkdir (dest_fs, entry->dest, get_default_dir_mode_perm ());
+                transfer_limit_leave (entered);
+        } else {
+                ret = mkdir (entry->dest, get_default_dir_mode_perm ());
+        }
+
+        if (ret == -1 && errno == EEXIST) {
+                if (dest_fs) {
+                        ret = glfs_stat (dest_fs, entry->dest, &statbuf);
+                } else {
+                        ret = stat (entry->dest, &statbuf);
+                }
+
+                if (ret == 0 && !S_ISDIR (statbuf.st_mode)) {
+                        errno = ENOTDIR;
+                        ret = -1;
+                }
+        }
+
+        if (ret == -1) {
+                error (0, errno, "cannot create directory %s", entry->dest);
+                return -1;
+        }
+
+        if (source_fs) {
+                fd = glfs_opendir (source_fs, entry->source);
+        } else {
+                dir = opendir (entry->source);
+        }
+
+        if (fd == NULL && dir == NULL) {
+                error (0, errno, "%s", entry->source);
+                return -1;
+        }
+
+        // Listing a directory along with the attributes of its entries saves
+        // a lookup of every one of them later.
+        if (fd) {
+                while (true) {
+                        entered = transfer_limit_enter ();
+                        dirent = glfs_readdirplus (fd, &statbuf);
+                        transfer_limit_leave (entered);
+                        if (dirent == NULL) {
+                                break;
+                        }
+
+                        if (queue_entry (walk, worker, entry, dirent->d_name,
+                                         &statbuf) == -1) {
+                                ret = -1;
+                        }
+                }
+
+                glfs_closedir (fd);
+        } else {
+                while ((dirent = readdir (dir)) != NULL) {
+                        if (fstatat (dirfd (dir), dirent->d_name, &statbuf,
+                                     AT_SYMLINK_NOFOLLOW) == -1) {
+                                error (0, errno, "%s/%s", entry->source, dirent->d_name);
+                                ret = -1;
+                                continue;
+                        }
+
+                        if (queue_entry (walk, worker, entry, dirent->d_name,
+                                         &statbuf) == -1) {
+                                ret = -1;
+                        }
+                }
+
+                closedir (dir);
+        }
+
+        return ret;
+}
+
+/**
+ * Recreates the symbolic link entry, pointing to the same place.
+ */
+static int
+copy_symlink (const struct entry *entry, glfs_t *source_fs, glfs_t *dest_fs)
+{
+        char target[PATH_MAX];
+        ssize_t length;
+        int ret;
+
+        if (source_fs) {
+                length = glfs_readlink (source_fs, entry->source, target,
+                                        sizeof (target) - 1);
+        } else {
+                length = readlink (entry->source, target, sizeof (target) - 1);
+        }
+
+        if (length == -1) {
+                error (0, errno, "%s", entry->source);
+                return -1;
+        }
+
+        target[length] = '\0';
+
+        if (dest_fs) {
+                ret = glfs_symlink (dest_fs, target, entry->dest);
+        } else {
+                ret = symlink (target, entry->dest);
+        }
+
+        if (ret == -1) {
+                error (0, errno, "cannot create symbolic link %s", entry->dest);
+        }
+
+        return ret;
+}
+
+/**
+ * Copies the regular file entry, unless it is another name of a file already
+ * copied, which is then linked to instead.
+ */
+static int
+copy_regular (struct tree *tree, const struct entry *entry,
+              const struct side *source, const struct side *dest)
+{
+        const char *target;
+        bool owner;
+        int ret;
+
+        if (entry->nlink < 2) {
+                return copy_file (entry->source, entry->dest, source, dest, NULL);
+        }
+
+        target = claim_inode (&tree->inodes, entry, &owner);
+        if (target) {
+                return link_file (target, entry->dest, dest->fs);
+        }
+
+        ret = copy_file (entry->source, entry->dest, source, dest, NULL);
+        if (owner) {
+                release_inode (&tree->inodes, entry, ret == 0);
+        }
+
+        return ret;
+}
+
+static int
+visit_entry (struct walk *walk, unsigned int worker, void *item)
+{
+        struct entry *entry = item;
+        struct tree *tree = walk_data (walk);
+        struct side source = worker_side (&tree->source, worker);
+        struct side dest = worker_side (&tree->dest, worker);
+        int ret;
+
+        if (S_ISDIR (entry->mode)) {
+                ret = copy_directory (walk, worker, entry, source.fs, dest.fs);
+        } else if (S_ISLNK (entry->mode)) {
+                ret = copy_symlink (entry, source.fs, dest.fs);
+        } else if (S_ISREG (entry->mode)) {
+                ret = copy_regular (tree, entry, &source, &dest);
+        } else {
+                error (0, 0, "%s: not copying special file", entry->source);
+                ret = -1;
+        }
+
+        free_entry (entry);
+
+        return ret;
+}
+
+/**
+ * Copies the directory source_path into dest_path, which it becomes, along
+ * with everything below it. The directories are walked by --jobs workers at
+ * once, each of which copies the files it comes across by itself and hands
+ * the directories out to whichever worker runs out of work first. Failures
+ * are reported as they happen and don't stop the rest of the copy. The data
+ * of a file with several names in the tree is copied once, and its other
+ * names are made links to that copy.
+ */
+static int
+copy_tree (const char *source_path, const char *dest_path,
+           const struct side *source, const struct side *dest,
+           const struct stat *statbuf)
+{
+        struct tree tree = { *source, *dest };
+        struct entry *root;
+        struct walk *walk;
+        size_t length = strlen (source_path);
+        int ret;
+
+        if (source->fs == dest->fs && strncmp (dest_path, source_path, length) == 0
+                        && (dest_path[length] == '/' || dest_path[length] == '\0')) {
+                error (0, 0, "cannot copy a directory, '%s', into itself, '%s'",
+                       source_path, dest_path);
+                return -1;
+        }
+
+        walk = walk_create (state->transfer.jobs, visit_entry, &tree);
+        if (walk == NULL) {
+                error (0, errno, "%s", source_path);
+                return -1;
+        }
+
+        root = new_entry (strdup (source_path), strdup (dest_path), statbuf);
+        if (root == NULL) {
+                error (0, errno, "%s", source_path);
+                walk_destroy (walk);
+                return -1;
+        }
+
+        init_inode_table (&tree.inodes);
+
+        ret = walk_push (walk, 0, root);
+        if (ret == -1) {
+                error (0, errno, "%s", source_path);
+                free_entry (root);
+        } else {
+                ret = walk_run (walk);
+        }
+
+        walk_destroy (walk);
+        destroy_inode_table (&tree.inodes);
+
+        return ret;
+}
+
+/**
+ * Copies source_path to dest_path, or into it if it is a directory, and
+ * with --recursive, the directories below source_path too. The size of the
+ * source is stored in size, when it is a regular file. brick names the
+ * subvolume of a file on Gluster, if it is known already.
+ */
+static int
+copy_item (const char *source_path, const char *dest_path,
+           const struct side *source, const struct side *dest, const char *brick,
+           off_t *size)
+{
+        struct stat statbuf;
+        char *full_path;
+        int ret;
+
+        *size = 0;
+
+        if (dest->fs) {
+                ret = glfs_lstat (dest->fs, dest_path, &statbuf);
+        } else {
+                ret = stat (dest_path, &statbuf);
+        }
+
+        full_path = complete_path (source_path, dest_path, ret == -1 ? NULL : &statbuf);
+        if (full_path == NULL) {
+                return -1;
+        }
+
+        if (source->fs) {
+                ret = glfs_stat (source->fs, source_path, &statbuf);
+        } else {
+                ret = stat (source_path, &statbuf);
+        }
+
+        if (ret == 0 && S_ISREG (statbuf.st_mode)) {
+                *size = statbuf.st_size;
+        }
+
+        if (ret == 0 && S_ISDIR (statbuf.st_mode)) {
+                if (!state->recursive) {
+                        error (0, 0, "-r not specified; omitting directory '%s'",
+                               source_path);
+                        ret = -1;
+                        goto out;
+                }
+
+                ret = copy_tree (source_path, full_path, source, dest, &statbuf);
+                goto out;
+        }
+
+        ret = copy_file (source_path, full_path, source, dest, brick);
+
+out:
+        free (full_path);
+
+        return ret;
+}
+
+/**
+ * Copies source_path to dest_path over the connections of the volumes named
+ * on the command line. A NULL fs stands for the local side.
+ */
+static int
+copy_path (const char *source_path, const char *dest_path,
+           glfs_t *source_fs, glfs_t *dest_fs)
+{
+        struct side source = { source_fs, &state->source_conns };
+        struct side dest = { dest_fs, &state->dest_conns };
+        off_t size;
+
+        return copy_item (source_path, dest_path, &source, &dest, NULL, &size);
+}
+
+/**
+ * A Gluster volume that the items of a manifest are copied to or from, along
+ * with the connections to it, which are opened for the first item on it and
+ * kept for the rest. A volume that couldn't be connected to has a NULL fs and
+ * the errno it failed with.
+ */
+struct volume {
+        struct volume *next;
+        char *name;
+        struct gluster_url *url;
+        glfs_t *fs;
+        struct transfer_connections conns;
+        bool established;
+        int error;
+};
+
+/**
+ * A source and destination pair read from a manifest, and the subvolume that
+ * the source is on, if it is on Gluster and --brick-jobs asks for it.
+ *
+ * round: How many items on the same subvolume come before this one.
+ * group: Which of the subvolumes it is, in the order they first turn up.
+ */
+struct item {
+        char *source;
+        char *dest;
+        char *brick;
+        size_t round;
+        size_t group;
+};
+
+static void
+free_item (struct item *item)
+{
+        free (item->source);
+        free (item->dest);
+        free (item->brick);
+        free (item);
+}
+
+/**
+ * The copy of a manifest, with the volumes connected to so far and the
+ * tally of the items done.
+ */
+struct manifest {
+        pthread_mutex_t lock;
+        struct cli_context *ctx;
+        struct volume *volumes;
+        size_t copied;
+        size_t failed;
+        off_t bytes;
+};
+
+/**
+ * Returns the volume that url, parsed from name, is on, connecting to it
+ * first if no item needed it before.
+ */
+static struct volume *
+get_volume (struct manifest *manifest, const struct gluster_url *url, const char *name)
+{
+        struct volume *volume;
+        int ret;
+
+        pthread_mutex_lock (&manifest->lock);
+        for (volume = manifest->volumes; volume; volume = volume->next) {
+                if (strcmp (volume->url->host, url->host) == 0
+                                && strcmp (volume->url->volume, url->volume) == 0
+                                && volume->url->port == url->port) {
+                        goto out;
+                }
+        }
+
+        volume = calloc (1, sizeof (*volume));
+        if (volume == NULL) {
+                goto out;
+        }
+
+        volume->name = strdup (name);
+        if (volume->name == NULL || gluster_parse_url (volume->name, &volume->url) == -1) {
+                free (volume->name);
+                free (volume);
+                volume = NULL;
+                goto out;
+        }
+
+        volume->url->port = url->port;
+
+        // Connecting can take seconds, and other items may be waiting for
+        // the lock meanwhile, but only ever once per volume.
+        ret = gluster_getfs (&volume->fs, volume->url);
+        if (ret == 0) {
+                ret = apply_xlator_options (volume->fs, &state->xlator_options);
+        }
+
+        if (ret == 0) {
+                ret = connect_volume (&volume->conns, volume->fs, volume->url,
+                                      &state->xlator_options, name);
+        } else {
+                error (0, errno, "%s", name);
+        }
+
+        if (ret == -1) {
+                volume->error = errno;
+                if (volume->fs) {
+                        glfs_fini (volume->fs);
+                        volume->fs = NULL;
+                }
+        }
+
+        volume->next = manifest->volumes;
+        manifest->volumes = volume;
+
+out:
+        pthread_mutex_unlock (&manifest->lock);
+
+        return volume;
+}
+
+/**
+ * Returns the connected volume of the shell, which the items of a manifest
+ * given in it are on unless they say otherwise.
+ */
+static struct volume *
+get_established_volume (struct manifest *manifest)
+{
+        struct cli_context *ctx = manifest->ctx;
+        struct volume *volume;
+
+        pthread_mutex_lock (&manifest->lock);
+        for (volume = manifest->volumes; volume; volume = volume->next) {
+                if (volume->established) {
+                        goto out;
+                }
+        }
+
+        volume = calloc (1, sizeof (*volume));
+        if (volume == NULL) {
+                goto out;
+        }
+
+        volume->established = true;
+        if (connect_volume (&volume->conns, ctx->fs, ctx->url,
+                            &ctx->options->xlator_options, ctx->conn_str) == 0) {
+                volume->fs = ctx->fs;
+        } else {
+                volume->error = errno;
+        }
+
+        volume->next = manifest->volumes;
+        manifest->volumes = volume;
+
+out:
+        pthread_mutex_unlock (&manifest->lock);
+
+        return volume;
+}
+
+static void
+free_volumes (struct manifest *manifest)
+{
+        struct volume *volume;
+
+        while ((volume = manifest->volumes) != NULL) {
+                manifest->volumes = volume->next;
+                gluster_fini_connections (&volume->conns);
+                if (volume->fs && !volume->established) {
+                        glfs_fini (volume->fs);
+                }
+
+                gluster_url_free (volume->url);
+                free (volume->name);
+                free (volume);
+        }
+}
+
+/**
+ * Works out which side name, a source or destination of a manifest, is on,
+ * and the path it stands for there. A glfs:// url is on its volume, and
+ * anything else is local, save in the shell, where only file:// urls are.
+ * The parsed url, if any, is stored in url, to be freed by the caller.
+ */
+static int
+resolve_side (struct manifest *manifest, char *name, struct side *side,
+              const char **path, struct gluster_url **url)
+{
+        struct volume *volume;
+        char *file_path;
+
+        *url = NULL;
+        side->fs = NULL;
+        side->conns = NULL;
+        *path = name;
+
+        if (strncmp (name, "glfs://", 7) == 0) {
+                char *copy = strdup (name);
+
+                if (copy == NULL || gluster_parse_url (copy, url) == -1) {
+                        free (copy);
+                        error (0, EINVAL, "%s", name);
+                        return -1;
+                }
+
+                (*url)->port = state->port;
+                volume = get_volume (manifest, *url, name);
+
+                // The url only points into copy for the host and volume.
+                *path = (*url)->path;
+                (*url)->host = NULL;
+                (*url)->volume = NULL;
+                free (copy);
+        } else if ((file_path = parse_file_url (name)) != NULL) {
+                *path = file_path;
+                return 0;
+        } else if (manifest->ctx->fs) {
+                volume = get_established_volume (manifest);
+        } else {
+                return 0;
+        }
+
+        if (volume == NULL) {
+                error (0, errno, "%s", name);
+                return -1;
+        }
+
+        if (volume->fs == NULL) {
+                errno = volume->error;
+                return -1;
+        }
+
+        side->fs = volume->fs;
+        side->conns = &volume->conns;
+
+        return 0;
+}
+
+static double
+seconds_since (const struct timespec *start)
+{
+        struct timespec now;
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+
+        return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Copies one item of a manifest, or one of several sources, and reports how
+ * it went, for a manifest, on a line of its own on standard output.
+ */
+static int
+visit_item (struct walk *walk, unsigned int worker, void *data)
+{
+        struct manifest *manifest = walk_data (walk);
+        struct item *item = data;
+        struct gluster_url *source_url = NULL;
+        struct gluster_url *dest_url = NULL;
+        const char *source_path;
+        const char *dest_path;
+        struct side source;
+        struct side dest;
+        struct timespec start;
+        off_t size = 0;
+        int ret;
+
+        clock_gettime (CLOCK_MONOTONIC, &start);
+
+        ret = resolve_side (manifest, item->source, &source, &source_path, &source_url);
+        if (ret == 0) {
+                ret = resolve_side (manifest, item->dest, &dest, &dest_path, &dest_url);
+        }
+
+        if (ret == 0 && source.fs == NULL && dest.fs == NULL) {
+                error (0, EINVAL, "%s: local source and destination", item->source);
+                ret = -1;
+        }
+
+        if (ret == 0) {
+                source = worker_side (&source, worker);
+                dest = worker_side (&dest, worker);
+                ret = copy_item (source_path, dest_path, &source, &dest, item->brick,
+                                 &size);
+        }
+
+        if (state->from_list) {
+                printf ("%s\t%jd\t%.3f\t%s\t%s\n", ret == 0 ? "ok" : "failed",
+                        (intmax_t) size, seconds_since (&start), item->source,
+                        item->dest);
+        }
+
+        pthread_mutex_lock (&manifest->lock);
+        if (ret == 0) {
+                manifest->copied++;
+                manifest->bytes += size;
+        } else {
+                manifest->failed++;
+        }
+        pthread_mutex_unlock (&manifest->lock);
+
+        gluster_url_free (source_url);
+        gluster_url_free (dest_url);
+        free_item (item);
+
+        return ret;
+}
+
+/**
+ * Reads the next source and destination pair from file, either as one line
+ * with a tab between them, or with -z, as two NUL terminated names in a row.
+ * Returns 0 at the end of the file, and -1 if the pair is cut short.
+ */
+static int
+read_item (FILE *file, char **line, size_t *size, size_t *number, struct item **item)
+{
+        int delim = state->null_data ? '\0' : '\n';
+        ssize_t length;
+        char *tab;
+
+        *item = NULL;
+
+        do {
+                length = getdelim (line, size, delim, file);
+                if (length == -1) {
+                        return 0;
+                }
+
+                (*number)++;
+                if (length > 0 && (*line)[length - 1] == delim) {
+                        (*line)[--length] = '\0';
+                }
+        } while (length == 0);
+
+        *item = calloc (1, sizeof (**item));
+        if (*item == NULL) {
+                return -1;
+        }
+
+        if (state->null_data) {
+                (*item)->source = strdup (*line);
+                length = getdelim (line, size, delim, file);
+                if (length > 0 && (*line)[length - 1] == delim) {
+                        (*line)[--length] = '\0';
+                }
+
+                if (length <= 0) {
+                        errno = EINVAL;
+                        goto err;
+                }
+
+                (*number)++;
+                (*item)->dest = strdup (*line);
+        } else {
+                tab = strchr (*line, '\t');
+                if (tab == NULL || tab == *line || tab[1] == '\0') {
+                        errno = EINVAL;
+                        goto err;
+                }
+
+                *tab = '\0';
+                (*item)->source = strdup (*line);
+                (*item)->dest = strdup (tab + 1);
+        }
+
+        if ((*item)->source && (*item)->dest) {
+                return 1;
+        }
+
+err:
+        free_item (*item);
+        *item = NULL;
+
+        return -1;
+}
+
+/**
+ * Looks up the subvolume that the source of a manifest item is on, if it is
+ * on Gluster. A source that can't be looked up is left for the copy to fail
+ * on.
+ */
+static int
+find_brick (struct walk *walk, unsigned int worker, void *data)
+{
+        struct manifest *manifest = walk_data (walk);
+        struct item *item = data;
+        struct gluster_url *url = NULL;
+        const char *path;
+        struct side side;
+
+        if (strncmp (item->source, "glfs://", 7) != 0 && !manifest->ctx->fs) {
+                return 0;
+        }
+
+        if (resolve_side (manifest, item->source, &side, &path, &url) == 0 && side.fs) {
+                side = worker_side (&side, worker);
+                item->brick = gluster_get_subvolume (side.fs, path);
+        }
+
+        gluster_url_free (url);
+
+        return 0;
+}
+
+static int
+compare_items (const void *a, const void *b)
+{
+        const struct item *item_a = *(struct item * const *) a;
+        const struct item *item_b = *(struct item * const *) b;
+
+        if (item_a->round != item_b->round) {
+                return item_a->round < item_b->round ? -1 : 1;
+        }
+
+        if (item_a->group != item_b->group) {
+                return item_a->group < item_b->group ? -1 : 1;
+        }
+
+        return 0;
+}
+
+/**
+ * Orders the count items so that the subvolumes of their sources take turns:
+ * the first item on each subvolume comes first, then the second one on each,
+ * and so on, keeping the order of the items on any one subvolume. The items
+ * are looked up by --jobs workers at once. Items that aren't on Gluster, or
+ * whose subvolume is unknown, take their turns as if they were on one more.
+ */
+static void
+schedule_items (struct manifest *manifest, struct item **items, size_t count)
+{
+        struct walk *walk;
+        char **names = NULL;
+        size_t *counts = NULL;
+        size_t ngroups = 0;
+        size_t i;
+        size_t j;
+
+        walk = walk_create (state->transfer.jobs, find_brick, manifest);
+        if (walk == NULL) {
+                return;
+        }
+
+        for (i = 0; i < count; i++) {
+                if (walk_push (walk, i % state->transfer.jobs, items[i]) == -1) {
+                        break;
+                }
+        }
+
+        walk_run (walk);
+        walk_destroy (walk);
+
+        // There are far fewer subvolumes than items, so a list will do.
+        names = calloc (count + 1, sizeof (*names));
+        counts = calloc (count + 1, sizeof (*counts));
+        if (names == NULL || counts == NULL) {
+                goto out;
+        }
+
+        for (i = 0; i < count; i++) {
+                for (j = 0; j < ngroups; j++) {
+                        if (names[j] == items[i]->brick || (names[j] && items[i]->brick
+                                        && strcmp (names[j], items[i]->brick) == 0)) {
+                                break;
+                        }
+                }
+
+                if (j == ngroups) {
+                        names[ngroups++] = items[i]->brick;
+                }
+
+                items[i]->group = j;
+                items[i]->round = counts[j]++;
+        }
+
+        qsort (items, count, sizeof (*items), compare_items);
+
+out:
+        free (counts);
+        free (names);
+}
+
+/**
+ * Copies the count items, --jobs of them at once, and frees them. With
+ * --brick-jobs, the subvolumes of the items take turns.
+ */
+static int
+copy_items (struct manifest *manifest, struct item **items, size_t count)
+{
+        struct walk *walk;
+        size_t i;
+        int ret = -1;
+
+        if (state->transfer.brick_jobs > 0) {
+                schedule_items (manifest, items, count);
+        }
+
+        walk = walk_create (state->transfer.jobs, visit_item, manifest);
+        if (walk == NULL) {
+                error (0, errno, "failed to start the copy");
+                i = count;
+                goto out;
+        }
+
+        // The items are dealt out in turn, last first, so that every worker
+        // starts on its own share in the order they were given in, and the
+        // ones left over are stolen from the end. Those that can't be queued
+        // are dropped, but the rest are still copied.
+        for (i = count; i > 0; i--) {
+                if (walk_push (walk, (i - 1) % state->transfer.jobs, items[i - 1]) == -1) {
+                        error (0, errno, "%s", items[i - 1]->source);
+                        break;
+                }
+        }
+
+        ret = walk_run (walk);
+        if (i > 0) {
+                ret = -1;
+        }
+
+        walk_destroy (walk);
+
+out:
+        while (i > 0) {
+                free_item (items[--i]);
+        }
+
+        return ret;
+}
+
+/**
+ * Copies every item of the manifest named by --from-list, --jobs of them at
+ * once, over one set of connections per volume for the whole manifest. Each
+ * item is reported as it is done, and the items copied and their throughput
+ * once they all are.
+ */
+static int
+cp_from_list (struct cli_context *ctx)
+{
+        struct manifest manifest = { PTHREAD_MUTEX_INITIALIZER, ctx };
+        struct item **items = NULL;
+        struct item **grown;
+        struct item *item = NULL;
+        size_t count = 0;
+        size_t allocated = 0;
+        size_t number = 0;
+        size_t length = 0;
+        char *line = NULL;
+        struct timespec start;
+        double elapsed;
+        FILE *file;
+        size_t i;
+        int ret = -1;
+
+        clock_gettime (CLOCK_MONOTONIC, &start);
+
+        if (strcmp (state->from_list, "-") == 0) {
+                file = stdin;
+        } else {
+                file = fopen (state->from_list, "r");
+                if (file == NULL) {
+                        error (0, errno, "%s", state->from_list);
+                        return -1;
+                }
+        }
+
+        // The whole manifest is read first, so that a broken one is turned
+        // down before anything is copied.
+        while ((ret = read_item (file, &line, &length, &number, &item)) == 1) {
+                if (count == allocated) {
+                        allocated = allocated ? allocated * 2 : 64;
+                        grown = realloc (items, allocated * sizeof (*items));
+                        if (grown == NULL) {
+                                ret = -1;
+                                break;
+                        }
+
+                        items = grown;
+                }
+
+                items[count++] = item;
+        }
+
+        if (ret == 0 && ferror (file)) {
+                ret = -1;
+        }
+
+        if (ret == -1 && errno == EINVAL) {
+                error (0, 0, "%s:%zu: expected a source and a destination",
+                       state->from_list, number);
+        } else if (ret == -1) {
+                error (0, errno, "%s:%zu", state->from_list, number);
+        }
+
+        if (ret == -1) {
+                if (item) {
+                        free_item (item);
+                }
+
+                goto out;
+        }
+
+        ret = copy_items (&manifest, items, count);
+        count = 0;
+
+        elapsed = seconds_since (&start);
+        fflush (stdout);
+        fprintf (stderr, "%s: %zu copied, %zu failed, %jd bytes in %.2f s, %.1f MiB/s\n",
+                 program_invocation_name, manifest.copied, manifest.failed,
+                 (intmax_t) manifest.bytes, elapsed,
+                 elapsed > 0 ? manifest.bytes / elapsed / (1024 * 1024) : 0);
+
+out:
+        for (i = 0; i < count; i++) {
+                free_item (items[i]);
+        }
+
+        free (items);
+        free (line);
+        free_volumes (&manifest);
+
+        if (file != stdin) {
+                fclose (file);
+        }
+
+        return ret;
+}
+
+/**
+ * Copies every one of the several sources given into the destination, which
+ * has to be a directory, --jobs of them at once, and over one set of
+ * connections per volume.
+ */
+static int
+cp_sources (struct cli_context *ctx)
+{
+        struct manifest manifest = { PTHREAD_MUTEX_INITIALIZER, ctx };
+        struct gluster_url *url = NULL;
+        struct item **items;
+        const char *dest_path;
+        struct side dest;
+        struct stat statbuf;
+        int i;
+        int ret;
+
+        ret = resolve_side (&manifest, state->dest, &dest, &dest_path, &url);
+        if (ret == -1) {
+                goto out;
+        }
+
+        if (dest.fs) {
+                ret = glfs_stat (dest.fs, dest_path, &statbuf);
+        } else {
+                ret = stat (dest_path, &statbuf);
+        }
+
+        if (ret == -1) {
+                error (0, errno, "target '%s'", state->dest);
+                goto out;
+        }
+
+        if (!S_ISDIR (statbuf.st_mode)) {
+                error (0, 0, "target '%s' is not a directory", state->dest);
+                ret = -1;
+                goto out;
+        }
+
+        items = calloc (state->nsources, sizeof (*items));
+        if (items == NULL) {
+                error (0, errno, "calloc");
+                ret = -1;
+                goto out;
+        }
+
+        for (i = 0; i < state->nsources; i++) {
+                items[i] = calloc (1, sizeof (**items));
+                if (items[i] == NULL
+                                || (items[i]->source = strdup (state->sources[i])) == NULL
+                                || (items[i]->dest = strdup (state->dest)) == NULL) {
+                        error (0, errno, "%s", state->sources[i]);
+                        ret = -1;
+                        break;
+                }
+        }
+
+        if (ret == 0) {
+                ret = copy_items (&manifest, items, state->nsources);
+        } else {
+                while (i >= 0) {
+                        if (items[i]) {
+                                free_item (items[i]);
+                        }
+
+                        i--;
+                }
+        }
+
+        free (items);
+
+out:
+        gluster_url_free (url);
+        free_volumes (&manifest);
+
+        return ret;
+}
+
+static int
+cp_without_context ()
+{
+        glfs_t *dest_fs = NULL;
+        glfs_t *source_fs = NULL;
+        int ret = -1;
+
+        switch (state->mode) {
+                case LOCAL_TO_REMOTE:
+                        ret = gluster_getfs (&dest_fs, state->gluster_dest);
+                        if (ret == -1) {
+                                error (0, errno, "%s", state->dest);
+                                goto out;
+                        }
+
+                        ret = apply_xlator_options (dest_fs, &state->xlator_options);
+                        if (ret == -1) {
+                                error (0, errno, "failed to apply translator options");
+                                goto out;
+                        }
+
+                        ret = connect_volume (&state->dest_conns, dest_fs,
+                                              state->gluster_dest,
+                                              &state->xlator_options,
+                                              state->dest);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
+                        ret = copy_path (state->source,
+                                         state->gluster_dest->path,
+                                         NULL,
+                                         dest_fs);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
+                        break;
+                case REMOTE_TO_LOCAL:
+                        ret = gluster_getfs (&source_fs, state->gluster_source);
+                        if (ret == -1) {
+                                error (0, errno, "%s", state->source);
+                                goto out;
+                        }
+
+                        ret = apply_xlator_options (source_fs, &state->xlator_options);
+                        if (ret == -1) {
+                                error (0, errno, "failed to apply translator options");
+                                goto out;
+                        }
+
+                        ret = connect_volume (&state->source_conns, source_fs,
+                                              state->gluster_source,
+                                              &state->xlator_options,
+                                              state->source);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
+                        ret = copy_path (state->gluster_source->path,
+                                         state->dest,
+                                         source_fs,
+                                         NULL);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
+                        break;
+                case REMOTE_TO_REMOTE:
+                        ret = gluster_getfs (&dest_fs, state->gluster_dest);
+                        if (ret == -1) {
+                                error (0, errno, "%s", state->dest);
+                                goto out;
+                        }
 
                         ret = apply_xlator_options (dest_fs, &state->xlator_options);
                         if (ret == -1) {
@@ -798,10 +2689,20 @@ cp_without_context ()
                                 goto out;
                         }
 
+                        ret = connect_volume (&state->dest_conns, dest_fs,
+                                              state->gluster_dest,
+                                              &state->xlator_options,
+                                              state->dest);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
                         /**
-                         * If the host and volume of the source and destination
-                         * are the same, then simply use the same connection to
-                         * make the transfer.
+                         * If the source and destination are on the same
+                         * volume, as told by their host and volume or else by
+                         * the ID of the volume, then simply use the same
+                         * connection to make the transfer, which lets the
+                         * bricks copy the data among themselves.
                          */
                         if (strcmp (state->gluster_source->host, state->gluster_dest->host) == 0
                                && strcmp (state->gluster_source->volume, state->gluster_dest->volume) == 0) {
@@ -813,24 +2714,39 @@ cp_without_context ()
                                         goto out;
                                 }
 
+                                if (gluster_same_volume (source_fs, dest_fs)) {
+                                        glfs_fini (source_fs);
+                                        source_fs = dest_fs;
+                                }
+                        }
+
+                        if (source_fs == dest_fs) {
+                                state->source_conns = state->dest_conns;
+                        } else {
                                 ret = apply_xlator_options (source_fs, &state->xlator_options);
                                 if (ret == -1) {
                                         error (0, errno, "failed to apply translator options");
                                         goto out;
                                 }
-                        }
 
-                        ret = remote_to_remote (state->gluster_source->path,
-                                                state->gluster_dest->path,
-                                                source_fs,
-                                                dest_fs);
-                        if (ret == -1) {
-                                goto out;
+                                ret = connect_volume (&state->source_conns, source_fs,
+                                                      state->gluster_source,
+                                                      &state->xlator_options,
+                                                      state->source);
+                                if (ret == -1) {
+                                        goto out;
+                                }
                         }
 
+                        ret = copy_path (state->gluster_source->path,
+                                         state->gluster_dest->path,
+                                         source_fs,
+                                         dest_fs);
+
+                        // A shared connection must only be torn down once.
                         if (dest_fs == source_fs) {
-                                glfs_fini (dest_fs);
-                                dest_fs = source_fs = NULL;
+                                source_fs = NULL;
+                                state->source_conns.count = 0;
                         }
 
                         break;
@@ -839,6 +2755,9 @@ cp_without_context ()
         }
 
 out:
+        gluster_fini_connections (&state->dest_conns);
+        gluster_fini_connections (&state->source_conns);
+
         if (dest_fs) {
                 glfs_fini (dest_fs);
         }
@@ -851,59 +2770,143 @@ out:
 }
 
 static int
-cp_with_context (glfs_t *fs)
+cp_with_context (struct cli_context *ctx)
 {
         glfs_t *dest_fs = NULL;
         glfs_t *source_fs = NULL;
+        glfs_t *fs = ctx->fs;
         int ret = -1;
 
         switch (state->mode) {
                 case ESTABLISHED_TO_ESTABLISHED:
-                        ret = remote_to_remote (state->source,
-                                                state->dest,
-                                                fs,
-                                                fs);
+                        ret = connect_volume (&state->dest_conns, fs, ctx->url,
+                                              &ctx->options->xlator_options,
+                                              ctx->conn_str);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
+                        state->source_conns = state->dest_conns;
+                        ret = copy_path (state->source,
+                                         state->dest,
+                                         fs,
+                                         fs);
+
+                        // The connections are shared and torn down once.
+                        state->source_conns.count = 0;
                         break;
                 case ESTABLISHED_TO_LOCAL:
-                        ret = remote_to_local (state->source, state->dest, fs);
+                        ret = connect_volume (&state->source_conns, fs, ctx->url,
+                                              &ctx->options->xlator_options,
+                                              ctx->conn_str);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
+                        ret = copy_path (state->source, state->dest, fs, NULL);
                         break;
                 case ESTABLISHED_TO_REMOTE:
+                        ret = connect_volume (&state->source_conns, fs, ctx->url,
+                                              &ctx->options->xlator_options,
+                                              ctx->conn_str);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
                         ret = gluster_getfs (&dest_fs, state->gluster_dest);
                         if (ret == -1) {
                                 error (0, errno, "%s", state->dest);
                                 goto out;
                         }
 
+                        // The URL may name the connected volume after all.
+                        if (gluster_same_volume (fs, dest_fs)) {
+                                glfs_fini (dest_fs);
+                                dest_fs = NULL;
+
+                                state->dest_conns = state->source_conns;
+                                ret = copy_path (state->source, state->gluster_dest->path,
+                                                 fs, fs);
+
+                                // The connections are shared and torn down once.
+                                state->dest_conns.count = 0;
+                                break;
+                        }
+
                         ret = apply_xlator_options (dest_fs, &state->xlator_options);
                         if (ret == -1) {
                                 error (0, errno, "failed to apply translator options");
                                 goto out;
                         }
 
-                        ret = remote_to_remote (state->source, state->gluster_dest->path, fs, dest_fs);
+                        ret = connect_volume (&state->dest_conns, dest_fs,
+                                              state->gluster_dest,
+                                              &state->xlator_options,
+                                              state->dest);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
+                        ret = copy_path (state->source, state->gluster_dest->path, fs, dest_fs);
 
                         break;
                 case LOCAL_TO_ESTABLISHED:
-                        ret = local_to_remote (state->source, state->dest, fs);
+                        ret = connect_volume (&state->dest_conns, fs, ctx->url,
+                                              &ctx->options->xlator_options,
+                                              ctx->conn_str);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
+                        ret = copy_path (state->source, state->dest, NULL, fs);
 
                         break;
                 case REMOTE_TO_ESTABLISHED:
+                        ret = connect_volume (&state->dest_conns, fs, ctx->url,
+                                              &ctx->options->xlator_options,
+                                              ctx->conn_str);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
                         ret = gluster_getfs (&source_fs, state->gluster_source);
                         if (ret == -1) {
                                 error (0, errno, "%s", state->source);
                                 goto out;
                         }
 
+                        // The URL may name the connected volume after all.
+                        if (gluster_same_volume (source_fs, fs)) {
+                                glfs_fini (source_fs);
+                                source_fs = NULL;
+
+                                state->source_conns = state->dest_conns;
+                                ret = copy_path (state->gluster_source->path,
+                                                 state->dest, fs, fs);
+
+                                // The connections are shared and torn down once.
+                                state->source_conns.count = 0;
+                                break;
+                        }
+
                         ret = apply_xlator_options (source_fs, &state->xlator_options);
                         if (ret == -1) {
                                 error (0, errno, "failed to apply translator options");
                                 goto out;
                         }
 
-                        ret = remote_to_remote (state->gluster_source->path,
-                                                state->dest,
-                                                source_fs,
-                                                fs);
+                        ret = connect_volume (&state->source_conns, source_fs,
+                                              state->gluster_source,
+                                              &state->xlator_options,
+                                              state->source);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
+                        ret = copy_path (state->gluster_source->path,
+                                         state->dest,
+                                         source_fs,
+                                         fs);
 
                         break;
                 // Fall through to cp_without_context () for the normal
@@ -918,6 +2921,9 @@ cp_with_context (glfs_t *fs)
         }
 
 out:
+        gluster_fini_connections (&state->dest_conns);
+        gluster_fini_connections (&state->source_conns);
+
         if (dest_fs) {
                 glfs_fini (dest_fs);
         }
@@ -929,6 +2935,33 @@ out:
         return ret;
 }
 
+/**
+ * Opens the file the checksums are written to, starts reporting transfer
+ * statistics and sets the rate limits, as asked for.
+ */
+static int
+start_copy ()
+{
+        if (state->transfer.checksum_file) {
+                state->checksum_out = fopen (state->transfer.checksum_file, "w");
+                if (state->checksum_out == NULL) {
+                        error (0, errno, "%s", state->transfer.checksum_file);
+                        return -1;
+                }
+        }
+
+        if (transfer_stats_start (state->transfer.stats,
+                                  state->transfer.stats_interval) == -1) {
+                error (0, errno, "failed to start transfer statistics");
+                return -1;
+        }
+
+        transfer_limit_set (state->transfer.bwlimit, state->transfer.iops_limit,
+                            state->transfer.target_latency);
+
+        return 0;
+}
+
 /**
  * Main entry point into application (called from glfs-cli.c)
  */
@@ -951,7 +2984,18 @@ do_cp (struct cli_context *ctx)
                         goto out;
                 }
 
-                ret = cp_with_context (ctx->fs);
+                ret = start_copy ();
+                if (ret == -1) {
+                        goto out;
+                }
+
+                if (state->from_list) {
+                        ret = cp_from_list (ctx);
+                } else if (state->sources) {
+                        ret = cp_sources (ctx);
+                } else {
+                        ret = cp_with_context (ctx);
+                }
         } else {
                 ret = parse_options (argc, argv, false);
                 switch (ret) {
@@ -962,9 +3006,22 @@ do_cp (struct cli_context *ctx)
                                 goto out;
                 }
 
-                ret = cp_without_context ();
+                ret = start_copy ();
+                if (ret == -1) {
+                        goto out;
+                }
+
+                if (state->from_list) {
+                        ret = cp_from_list (ctx);
+                } else if (state->sources) {
+                        ret = cp_sources (ctx);
+                } else {
+                        ret = cp_without_context ();
+                }
         }
 
+        transfer_stats_stop ();
+
 out:
         if (state) {
                 if (state->gluster_dest) {
@@ -975,8 +3032,15 @@ out:
                         gluster_url_free (state->gluster_source);
                 }
 
+                if (state->checksum_out && fclose (state->checksum_out) == EOF) {
+                        error (0, errno, "%s", state->transfer.checksum_file);
+                        ret = -1;
+                }
+
                 free (state->dest);
                 free (state->source);
+                free (state->from_list);
+                destroy_bricks (&state->bricks);
         }
 
         free (state);
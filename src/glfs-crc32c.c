@@ -0,0 +1,246 @@
+/**
+ * CRC32C (Castagnoli), as used by iSCSI and ext4, for checksumming the data
+ * of a transfer as it goes by.
+ *
+ * On x86-64 processors with SSE4.2 the crc32 instruction does the work;
+ * elsewhere, a table-driven version processes eight bytes at a time. The
+ * checksums of pieces of data can be combined into the checksum of the whole
+ * without going over the data again, so that byte ranges copied in any order,
+ * and holes that are never read, still add up to the checksum of the file.
+ *
+ * Copyright (C) 2015 Facebook Inc.
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "glfs-crc32c.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// The reflected Castagnoli polynomial.
+#define POLY 0x82f63b78
+
+static uint32_t table[8][256];
+static uint32_t (*update) (uint32_t state, const unsigned char *buf, size_t len);
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static uint32_t
+update_table (uint32_t state, const unsigned char *buf, size_t len)
+{
+        uint64_t word;
+
+        while (len > 0 && ((uintptr_t) buf & 7) != 0) {
+                state = table[0][(state ^ *buf++) & 0xff] ^ (state >> 8);
+                len--;
+        }
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // Slicing-by-8, which takes the bytes of word in memory order.
+        while (len >= 8) {
+                memcpy (&word, buf, 8);
+                word ^= state;
+                state = table[7][word & 0xff]
+                        ^ table[6][(word >> 8) & 0xff]
+                        ^ table[5][(word >> 16) & 0xff]
+                        ^ table[4][(word >> 24) & 0xff]
+                        ^ table[3][(word >> 32) & 0xff]
+                        ^ table[2][(word >> 40) & 0xff]
+                        ^ table[1][(word >> 48) & 0xff]
+                        ^ table[0][word >> 56];
+                buf += 8;
+                len -= 8;
+        }
+#endif
+
+        while (len > 0) {
+                state = table[0][(state ^ *buf++) & 0xff] ^ (state >> 8);
+                len--;
+        }
+
+        return state;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__ ((target ("sse4.2")))
+static uint32_t
+update_sse42 (uint32_t state, const unsigned char *buf, size_t len)
+{
+        uint64_t crc = state;
+        uint64_t word;
+
+        while (len > 0 && ((uintptr_t) buf & 7) != 0) {
+                crc = __builtin_ia32_crc32qi (crc, *buf++);
+                len--;
+        }
+
+        while (len >= 8) {
+                memcpy (&word, buf, 8);
+                crc = __builtin_ia32_crc32di (crc, word);
+                buf += 8;
+                len -= 8;
+        }
+
+        while (len > 0) {
+                crc = __builtin_ia32_crc32qi (crc, *buf++);
+                len--;
+        }
+
+        return crc;
+}
+#endif
+
+static void
+init ()
+{
+        uint32_t crc;
+        int i;
+        int j;
+
+        for (i = 0; i < 256; i++) {
+                crc = i;
+                for (j = 0; j < 8; j++) {
+                        crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+                }
+
+                table[0][i] = crc;
+        }
+
+        for (i = 0; i < 256; i++) {
+                for (j = 1; j < 8; j++) {
+                        table[j][i] = table[0][table[j - 1][i] & 0xff]
+                                ^ (table[j - 1][i] >> 8);
+                }
+        }
+
+        update = update_table;
+#if defined(__x86_64__) && defined(__GNUC__)
+        if (__builtin_cpu_supports ("sse4.2")) {
+                update = update_sse42;
+        }
+#endif
+}
+
+/**
+ * Returns the CRC32C of the data whose CRC32C so far is crc followed by len
+ * bytes of buf. Start with a crc of 0.
+ */
+uint32_t
+crc32c (uint32_t crc, const void *buf, size_t len)
+{
+        pthread_once (&once, init);
+
+        return ~update (~crc, buf, len);
+}
+
+static uint32_t
+gf2_matrix_times (const uint32_t *mat, uint32_t vec)
+{
+        uint32_t sum = 0;
+
+        while (vec != 0) {
+                if (vec & 1) {
+                        sum ^= *mat;
+                }
+
+                vec >>= 1;
+                mat++;
+        }
+
+        return sum;
+}
+
+static void
+gf2_matrix_square (uint32_t *square, const uint32_t *mat)
+{
+        int n;
+
+        for (n = 0; n < 32; n++) {
+                square[n] = gf2_matrix_times (mat, mat[n]);
+        }
+}
+
+/**
+ * Returns crc as it would be after another len zero bytes, if it were not
+ * inverted before and after. The operator for one zero bit is squared up to
+ * the operator for each bit of len in turn, so this takes O(log len).
+ */
+static uint32_t
+shift (uint32_t crc, uint64_t len)
+{
+        uint32_t even[32];
+        uint32_t odd[32];
+        uint32_t row = 1;
+        int n;
+
+        if (len == 0) {
+                return crc;
+        }
+
+        odd[0] = POLY;
+        for (n = 1; n < 32; n++) {
+                odd[n] = row;
+                row <<= 1;
+        }
+
+        // Two, then four zero bits.
+        gf2_matrix_square (even, odd);
+        gf2_matrix_square (odd, even);
+
+        do {
+                gf2_matrix_square (even, odd);
+                if (len & 1) {
+                        crc = gf2_matrix_times (even, crc);
+                }
+
+                len >>= 1;
+                if (len == 0) {
+                        break;
+                }
+
+                gf2_matrix_square (odd, even);
+                if (len & 1) {
+                        crc = gf2_matrix_times (odd, crc);
+                }
+
+                len >>= 1;
+        } while (len != 0);
+
+        return crc;
+}
+
+/**
+ * Returns the CRC32C of two pieces of data one after the other, given the
+ * CRC32C of each and the length of the second.
+ */
+uint32_t
+crc32c_combine (uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+        return shift (crc1, len2) ^ crc2;
+}
+
+/**
+ * Returns the CRC32C of the data whose CRC32C so far is crc followed by len
+ * zero bytes, as read from a hole.
+ */
+uint32_t
+crc32c_zeros (uint32_t crc, uint64_t len)
+{
+        return shift (crc, len) ^ ~shift (0xffffffff, len);
+}
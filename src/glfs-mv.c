@@ -22,6 +22,7 @@
 #include <config.h>
 
 #include "glfs-mv.h"
+#include "glfs-transfer.h"
 #include "glfs-util.h"
 
 #include <errno.h>
@@ -39,7 +40,6 @@
 #include <unistd.h>
 
 #define AUTHORS "Written by Akshay Venugopal."
-#define BUFFER_SIZE 1024*1024
 
 /**
  * Represents the various transfer modes supported by gfcp.
@@ -577,8 +577,8 @@ local_to_remote (const char *local_path, const char *remote_path, glfs_t *fs)
                 goto out;
         }
 
-        if (gluster_write (fd, remote_fd) == 0) {
-                ret = -1;
+        ret = gluster_write (fd, remote_fd, NULL);
+        if (ret == -1) {
                 error (0, errno, "failed to transfer %s", local_path);
         }
 
@@ -639,7 +639,7 @@ remote_to_local (const char *remote_path, const char *local_path, glfs_t *fs)
                 goto out;
         }
 
-        if ((ret = gluster_read (remote_fd, local_fd)) == -1) {
+        if ((ret = gluster_read (remote_fd, local_fd, NULL)) == -1) {
                 error (0, errno, "write error");
         }
 
@@ -665,12 +665,11 @@ static int
 remote_to_remote (const char *source_path, const char *dest_path, glfs_t *source_fs, glfs_t *dest_fs)
 {
         int ret = -1;
-        size_t num_read = 0;
-        size_t num_written = 0;
         glfs_fd_t *source_fd = NULL;
         glfs_fd_t *dest_fd = NULL;
+        struct transfer_endpoint source;
+        struct transfer_endpoint dest;
         struct stat statbuf;
-        char buf[BUFFER_SIZE];
         char *full_path;
 
         ret = glfs_lstat (dest_fs, dest_path, &statbuf);
@@ -698,28 +697,12 @@ remote_to_remote (const char *source_path, const char *dest_path, glfs_t *source
                 goto out;
         }
 
-        while (true) {
-                num_read = glfs_read (source_fd, buf, BUFFER_SIZE, 0);
-                if (num_read == -1) {
-                        ret = -1;
-                        goto out;
-                }
-
-                if (num_read == 0) {
-                        goto out;
-                }
-
-                for (num_written = 0; num_written < num_read;) {
-                        ret = glfs_write (dest_fd,
-                                        &buf[num_written],
-                                        num_read - num_written, 0);
-                        if (ret == -1) {
-                                error (0, errno, "write error");
-                                goto out;
-                        }
+        transfer_gluster (&source, source_fd);
+        transfer_gluster (&dest, dest_fd);
 
-                        num_written += ret;
-                }
+        ret = transfer (&source, &dest, NULL);
+        if (ret == -1) {
+                error (0, errno, "write error");
         }
 
 out:
@@ -736,6 +719,40 @@ out:
         return ret;
 }
 
+/**
+ * Moves source_path to dest_path within the volume of fs by renaming it, so
+ * that none of its data has to be copied. As with a copy, a file moved onto
+ * a directory lands in it.
+ */
+static int
+rename_remote (const char *source_path, const char *dest_path, glfs_t *fs)
+{
+        int ret = -1;
+        struct stat statbuf;
+        char *full_path;
+
+        ret = glfs_lstat (fs, dest_path, &statbuf);
+
+        if (ret == -1) {
+                full_path = complete_path (source_path, dest_path, NULL);
+        } else {
+                full_path = complete_path (source_path, dest_path, &statbuf);
+        }
+
+        if (full_path == NULL) {
+                return -1;
+        }
+
+        ret = glfs_rename (fs, source_path, full_path);
+        if (ret == -1) {
+                error (0, errno, "cannot move %s to %s", source_path, full_path);
+        }
+
+        free (full_path);
+
+        return ret;
+}
+
 static int
 rm_local( char *path )
 {
@@ -776,6 +793,10 @@ mv_without_context ()
                         ret = local_to_remote (state->source,
                                                 state->gluster_dest->path,
                                                 dest_fs);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
                         ret = rm_local( state->source );
                         if (ret == -1) {
                                 goto out;
@@ -798,6 +819,10 @@ mv_without_context ()
                         ret = remote_to_local (state->gluster_source->path,
                                                 state->dest,
                                                 source_fs);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
                         ret = rm_remote( source_fs, state->gluster_source->path );
                         if (ret == -1) {
                                 goto out;
@@ -818,20 +843,48 @@ mv_without_context ()
                         }
 
                         /**
-                         * If the host and volume of the source and destination
-                         * are the same, then simply rename the source file to
-                         * the destination file
+                         * If the source and destination are on the same
+                         * volume, as told by their host and volume or else by
+                         * the ID of the volume, then simply rename the source
+                         * file to the destination file
                          */
-                        ret = glfs_rename(dest_fs, state->gluster_source->path, state->gluster_dest->path );
+                        if (strcmp (state->gluster_source->host, state->gluster_dest->host) == 0
+                               && strcmp (state->gluster_source->volume, state->gluster_dest->volume) == 0) {
+                                ret = rename_remote (state->gluster_source->path,
+                                                     state->gluster_dest->path,
+                                                     dest_fs);
+                                goto out;
+                        }
+
+                        ret = gluster_getfs (&source_fs, state->gluster_source);
                         if (ret == -1) {
+                                error (0, errno, "%s", state->source);
                                 goto out;
                         }
 
-                        if (dest_fs == source_fs) {
-                                glfs_fini (dest_fs);
-                                dest_fs = source_fs = NULL;
+                        if (gluster_same_volume (source_fs, dest_fs)) {
+                                ret = rename_remote (state->gluster_source->path,
+                                                     state->gluster_dest->path,
+                                                     dest_fs);
+                                goto out;
                         }
 
+                        ret = apply_xlator_options (source_fs, &state->xlator_options);
+                        if (ret == -1) {
+                                error (0, errno, "failed to apply translator options");
+                                goto out;
+                        }
+
+                        ret = remote_to_remote (state->gluster_source->path,
+                                                state->gluster_dest->path,
+                                                source_fs,
+                                                dest_fs);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
+                        ret = rm_remote( source_fs, state->gluster_source->path );
+
                         break;
                 default:
                         error (0, errno, "unknown error");
@@ -862,10 +915,14 @@ mv_with_context (glfs_t *fs)
                        * are the same, then simply rename the source file to
                        * the destination file
                        */
-                        ret = glfs_rename(fs, state->source, state->dest);
+                        ret = rename_remote (state->source, state->dest, fs);
                         break;
                 case ESTABLISHED_TO_LOCAL:
                         ret = remote_to_local (state->source, state->dest, fs);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
                         ret = rm_remote( fs, state->source );
                         break;
                 case ESTABLISHED_TO_REMOTE:
@@ -875,6 +932,12 @@ mv_with_context (glfs_t *fs)
                                 goto out;
                         }
 
+                        // The URL may name the connected volume after all.
+                        if (gluster_same_volume (fs, dest_fs)) {
+                                ret = rename_remote (state->source, state->gluster_dest->path, fs);
+                                break;
+                        }
+
                         ret = apply_xlator_options (dest_fs, &state->xlator_options);
                         if (ret == -1) {
                                 error (0, errno, "failed to apply translator options");
@@ -882,10 +945,18 @@ mv_with_context (glfs_t *fs)
                         }
 
                         ret = remote_to_remote (state->source, state->gluster_dest->path, fs, dest_fs);
+                        if (ret == -1) {
+                                goto out;
+                        }
 
+                        ret = rm_remote( fs, state->source );
                         break;
                 case LOCAL_TO_ESTABLISHED:
                         ret = local_to_remote (state->source, state->dest, fs);
+                        if (ret == -1) {
+                                goto out;
+                        }
+
                         ret = rm_local( state->source );
                         break;
                 case REMOTE_TO_ESTABLISHED:
@@ -895,6 +966,12 @@ mv_with_context (glfs_t *fs)
                                 goto out;
                         }
 
+                        // The URL may name the connected volume after all.
+                        if (gluster_same_volume (source_fs, fs)) {
+                                ret = rename_remote (state->gluster_source->path, state->dest, fs);
+                                break;
+                        }
+
                         ret = apply_xlator_options (source_fs, &state->xlator_options);
                         if (ret == -1) {
                                 error (0, errno, "failed to apply translator options");
@@ -905,7 +982,11 @@ mv_with_context (glfs_t *fs)
                                                 state->dest,
                                                 source_fs,
                                                 fs);
+                        if (ret == -1) {
+                                goto out;
+                        }
 
+                        ret = rm_remote( source_fs, state->gluster_source->path );
                         break;
                 // Fall through to mv_without_context () for the normal
                 // transfer functions.
@@ -21,6 +21,7 @@
 
 #include <config.h>
 
+#include "glfs-transfer.h"
 #include "glfs-util.h"
 
 #include <errno.h>
@@ -44,6 +45,10 @@
  * append: Whether to append to the file instead of replacing it.
  * debug: Whether to log additional debug information.
  * parents: Whether all parent directories in the path are created.
+ * size: Expected amount of data on standard input, or -1 if unknown.
+ * transfer: Tuning options for the data transfer.
+ * conns: Connections to the volume.
+ * crc: Checksum of the data put, if verified or recorded.
  */
 struct state {
         struct gluster_url *gluster_url;
@@ -53,6 +58,10 @@ struct state {
         bool debug;
         bool overwrite;
         bool parents;
+        off_t size;
+        struct transfer_options transfer;
+        struct transfer_connections conns;
+        uint32_t crc;
 };
 
 static struct state *state;
@@ -60,11 +69,28 @@ static struct state *state;
 static struct option const long_options[] =
 {
         {"append", no_argument, NULL, 'a'},
+        {"block-size", required_argument, NULL, TRANSFER_OPTION_BLOCK_SIZE},
+        {"buffer-size", required_argument, NULL, TRANSFER_OPTION_BUFFER_SIZE},
+        {"buffers", required_argument, NULL, TRANSFER_OPTION_BUFFERS},
+        {"bwlimit", required_argument, NULL, TRANSFER_OPTION_BWLIMIT},
+        {"checksum-out", required_argument, NULL, TRANSFER_OPTION_CHECKSUM_OUT},
+        {"connections", required_argument, NULL, TRANSFER_OPTION_CONNECTIONS},
         {"debug", no_argument, NULL, 'd'},
+        {"direct", no_argument, NULL, TRANSFER_OPTION_DIRECT},
         {"help", no_argument, NULL, 'x'},
+        {"huge-pages", no_argument, NULL, TRANSFER_OPTION_HUGE_PAGES},
+        {"io-uring", no_argument, NULL, TRANSFER_OPTION_IO_URING},
+        {"iops-limit", required_argument, NULL, TRANSFER_OPTION_IOPS_LIMIT},
+        {"mmap", no_argument, NULL, TRANSFER_OPTION_MMAP},
         {"overwrite", no_argument, NULL, 'f'},
         {"parents", required_argument, NULL, 'r'},
         {"port", required_argument, NULL, 'p'},
+        {"queue-depth", required_argument, NULL, TRANSFER_OPTION_QUEUE_DEPTH},
+        {"size", required_argument, NULL, 's'},
+        {"stats", required_argument, NULL, TRANSFER_OPTION_STATS},
+        {"stats-interval", required_argument, NULL, TRANSFER_OPTION_STATS_INTERVAL},
+        {"target-latency", required_argument, NULL, TRANSFER_OPTION_TARGET_LATENCY},
+        {"verify", no_argument, NULL, TRANSFER_OPTION_VERIFY},
         {"version", no_argument, NULL, 'v'},
         {"xlator-option", required_argument, NULL, 'o'},
         {NULL, no_argument, NULL, 0}
@@ -76,13 +102,59 @@ usage (const int status)
         printf ("Usage: %s [OPTION]... URL\n"
                 "Put data from standard input on a remote Gluster volume.\n\n"
                 "  -a, --append                 append data to the end of the file\n"
+                "      --block-size=SIZE        read and write SIZE bytes at a time; SIZE\n"
+                "                               may end in K or M. With 'auto', start\n"
+                "                               from the layout of the files and adjust\n"
+                "                               it to the measured throughput (default:\n"
+                "                               the buffer size)\n"
+                "      --buffer-size=SIZE       use buffers of SIZE bytes, at least the\n"
+                "                               block size (default: 256K, or 4M with\n"
+                "                               --block-size=auto)\n"
+                "      --buffers=N              use N buffers of that size per transfer\n"
+                "                               (default: twice the queue depth, at\n"
+                "                               least 4)\n"
+                "      --bwlimit=RATE           read no more than RATE bytes per second\n"
+                "                               in all; RATE may end in K, M or G\n"
+                "      --checksum-out=FILE      write the CRC32C of the data to FILE\n"
+                "      --connections=N          open N connections to the Gluster volume\n"
+                "                               and spread the writes across them\n"
+                "                               (default: 1)\n"
+                "      --direct                 keep a regular file that standard input\n"
+                "                               is redirected from out of the page cache,\n"
+                "                               with O_DIRECT where the file system\n"
+                "                               allows it\n"
+                "      --huge-pages             back large buffers with transparent huge\n"
+                "                               pages\n"
+                "      --io-uring               read and write local files through\n"
+                "                               io_uring, with up to the queue depth of\n"
+                "                               fops in flight\n"
+                "      --iops-limit=N           issue no more than N reads and writes\n"
+                "                               per second in all\n"
+                "      --mmap                   read standard input straight from the\n"
+                "                               memory of a regular file, which must not\n"
+                "                               shrink meanwhile\n"
                 "  -f, --overwrite              overwrite the existing file\n"
                 "  -o, --xlator-option=OPTION   specify a translator option for the\n"
                 "                               connection. Multiple options are supported\n"
                 "                               and take the form xlator.key=value.\n"
                 "  -p, --port=PORT              specify the port on which to connect\n"
+                "      --queue-depth=N          keep up to N writes in flight on the\n"
+                "                               Gluster volume (default: 1)\n"
                 "  -r, --parents                no error if existing, make parent\n"
                 "                               directories as needed\n"
+                "  -s, --size=SIZE              preallocate SIZE bytes for the data on\n"
+                "                               standard input; SIZE may end in K, M, G\n"
+                "                               or T\n"
+                "      --stats=FORMAT           report transfer statistics on standard\n"
+                "                               error when done, as 'text' or 'json'\n"
+                "      --stats-interval=N       also report them every N seconds\n"
+                "      --target-latency=TIME    adjust the number of reads and writes in\n"
+                "                               flight on Gluster, up to what\n"
+                "                               --queue-depth allows, to keep each of them\n"
+                "                               within TIME; TIME may end in us, ms or s\n"
+                "                               (default unit: ms)\n"
+                "      --verify                 read the data back when done and check\n"
+                "                               it against the CRC32C of what was sent\n"
                 "      --help       display this help and exit\n"
                 "      --version    output version information and exit\n\n"
                 "Examples:\n"
@@ -107,7 +179,7 @@ parse_options (int argc, char *argv[])
         struct xlator_option *option;
 
         while (true) {
-                opt = getopt_long (argc, argv, "adfo:p:r", long_options,
+                opt = getopt_long (argc, argv, "adfo:p:rs:", long_options,
                                    &option_index);
 
                 if (opt == -1) {
@@ -142,9 +214,37 @@ parse_options (int argc, char *argv[])
                                         exit (EXIT_FAILURE);
                                 }
 
+                                break;
+                        case TRANSFER_OPTION_BLOCK_SIZE:
+                        case TRANSFER_OPTION_BUFFER_SIZE:
+                        case TRANSFER_OPTION_BUFFERS:
+                        case TRANSFER_OPTION_BWLIMIT:
+                        case TRANSFER_OPTION_CHECKSUM_OUT:
+                        case TRANSFER_OPTION_CONNECTIONS:
+                        case TRANSFER_OPTION_DIRECT:
+                        case TRANSFER_OPTION_HUGE_PAGES:
+                        case TRANSFER_OPTION_IO_URING:
+                        case TRANSFER_OPTION_IOPS_LIMIT:
+                        case TRANSFER_OPTION_MMAP:
+                        case TRANSFER_OPTION_QUEUE_DEPTH:
+                        case TRANSFER_OPTION_STATS:
+                        case TRANSFER_OPTION_STATS_INTERVAL:
+                        case TRANSFER_OPTION_TARGET_LATENCY:
+                        case TRANSFER_OPTION_VERIFY:
+                                if (parse_transfer_option (opt, optarg, &state->transfer) == -1) {
+                                        exit (EXIT_FAILURE);
+                                }
+
                                 break;
                         case 'r':
                                 state->parents = true;
+                                break;
+                        case 's':
+                                state->size = strtosize (optarg);
+                                if (state->size == -1) {
+                                        error (EXIT_FAILURE, 0, "invalid size: \"%s\"", optarg);
+                                }
+
                                 break;
                         case 'v':
                                 printf ("%s (%s) %s\n%s\n%s\n%s\n",
@@ -162,7 +262,7 @@ parse_options (int argc, char *argv[])
                 }
         }
 
-        if ((argc - option_index) < 2) {
+        if ((argc - optind) < 1) {
                 error (0, 0, "missing operand");
                 goto err;
         } else {
@@ -203,7 +303,11 @@ init_state ()
         state->gluster_url = NULL;
         state->overwrite = false;
         state->parents = false;
+        state->size = -1;
         state->url = NULL;
+        state->xlator_options = NULL;
+        state->conns.count = 0;
+        transfer_options_init (&state->transfer);
 
 out:
         return state;
@@ -214,9 +318,16 @@ gluster_put (glfs_t *fs, struct state *state)
 {
         int ret = -1;
         glfs_fd_t *fd = NULL;
+        struct transfer_endpoint source;
+        struct transfer_endpoint dest;
         char *filename = state->gluster_url->path;
+        struct transfer_file file = { TRANSFER_GLUSTER, &state->conns, filename };
         char *dir_path = strdup (state->gluster_url->path);
         struct stat statbuf;
+        off_t offset = 0;
+        off_t end;
+        uint32_t crc;
+        FILE *checksum_out;
 
         if (dir_path == NULL) {
                 error (EXIT_FAILURE, errno, "strdup");
@@ -250,8 +361,9 @@ gluster_put (glfs_t *fs, struct state *state)
         }
 
         if (state->append) {
-                ret = glfs_lseek (fd, 0, SEEK_END);
-                if (ret == -1) {
+                offset = glfs_lseek (fd, 0, SEEK_END);
+                if (offset == -1) {
+                        ret = -1;
                         error (0, errno, "seek error: %s", filename);
                         goto out;
                 }
@@ -267,8 +379,83 @@ gluster_put (glfs_t *fs, struct state *state)
                 }
         }
 
-        if (gluster_write (STDIN_FILENO, fd) == 0) {
+        transfer_local (&source, STDIN_FILENO);
+        transfer_gluster (&dest, fd);
+
+        if (state->size != -1) {
+                ret = transfer_preallocate (&dest, offset, state->size);
+                if (ret == -1) {
+                        goto out;
+                }
+        }
+
+        ret = transfer_open_connections (&dest, &state->conns, filename, O_WRONLY);
+        if (ret == -1) {
+                goto out;
+        }
+
+        state->crc = 0;
+        if (state->transfer.verify || state->transfer.checksum_file) {
+                state->transfer.checksum = &state->crc;
+        }
+
+        ret = transfer (&source, &dest, &state->transfer);
+        transfer_close_connections (&dest);
+        if (ret == -1) {
+                goto out;
+        }
+
+        end = glfs_lseek (fd, 0, SEEK_CUR);
+        if (end == -1) {
                 ret = -1;
+                goto out;
+        }
+
+        // Give back whatever was reserved beyond the data that actually came.
+        if (state->size != -1 && end < offset + state->size) {
+#ifdef HAVE_GLFS_7_6
+                ret = glfs_ftruncate (fd, end, NULL, NULL);
+#else
+                ret = glfs_ftruncate (fd, end);
+#endif
+                if (ret == -1) {
+                        goto out;
+                }
+        }
+
+        // Only the data put this time is checked, even when appending.
+        if (state->transfer.verify) {
+                ret = transfer_checksum (&file, offset, end - offset,
+                                         &state->transfer, &crc);
+                if (ret == -1) {
+                        goto out;
+                }
+
+                if (crc != state->crc) {
+                        error (0, 0, "%s: checksum mismatch", state->url);
+                        errno = EIO;
+                        ret = -1;
+                        goto out;
+                }
+        }
+
+        if (state->transfer.checksum_file) {
+                checksum_out = fopen (state->transfer.checksum_file, "w");
+                if (checksum_out == NULL) {
+                        error (0, errno, "%s", state->transfer.checksum_file);
+                        ret = -1;
+                        goto out;
+                }
+
+                ret = transfer_write_checksum (checksum_out, state->url, state->crc);
+                if (fclose (checksum_out) == EOF) {
+                        ret = -1;
+                }
+
+                if (ret == -1) {
+                        error (0, errno, "%s", state->transfer.checksum_file);
+                        goto out;
+                }
         }
 
 out:
@@ -319,7 +506,27 @@ main (int argc, char *argv[])
                 }
         }
 
+        ret = gluster_getfs_connections (&state->conns, fs,
+                                         state->transfer.connections,
+                                         state->gluster_url,
+                                         &state->xlator_options);
+        if (ret == -1) {
+                error (0, errno, "%s", state->url);
+                goto err;
+        }
+
+        ret = transfer_stats_start (state->transfer.stats,
+                                    state->transfer.stats_interval);
+        if (ret == -1) {
+                error (0, errno, "failed to start transfer statistics");
+                goto err;
+        }
+
+        transfer_limit_set (state->transfer.bwlimit, state->transfer.iops_limit,
+                            state->transfer.target_latency);
+
         ret = gluster_put (fs, state);
+        transfer_stats_stop ();
         if (ret == -1) {
                 error (0, errno, "%s", state->url);
                 goto err;
@@ -331,6 +538,10 @@ main (int argc, char *argv[])
 err:
         ret = EXIT_FAILURE;
 out:
+        if (state) {
+                gluster_fini_connections (&state->conns);
+        }
+
         if (fs) {
                 glfs_fini (fs);
         }
@@ -342,10 +342,16 @@ tail_lines (glfs_fd_t *fd, struct stat *statbuf)
         int ret = 0;
         int newline_count = 0;
         ssize_t num_read;
-        char buffer[BUFSIZE];
+        char *buffer;
         long long offset;
         long long size = (long long) statbuf->st_size;
 
+        buffer = buffer_pool_get (BUFSIZE, false);
+        if (buffer == NULL) {
+                error (0, errno, "failed to allocate read buffer");
+                goto err;
+        }
+
         offset = size - BUFSIZE;
         if (offset < 0) {
                 offset = 0;
@@ -363,7 +369,7 @@ tail_lines (glfs_fd_t *fd, struct stat *statbuf)
                         goto err;
                 }
 
-                num_read = glfs_read (fd, &buffer, BUFSIZE, 0);
+                num_read = glfs_read (fd, buffer, BUFSIZE, 0);
                 if (num_read == -1) {
                         error (0, errno, "read error");
                         goto err;
@@ -388,7 +394,7 @@ tail_lines (glfs_fd_t *fd, struct stat *statbuf)
                 }
         }
 
-        num_read = glfs_read (fd, &buffer, BUFSIZE, 0);
+        num_read = glfs_read (fd, buffer, BUFSIZE, 0);
         if (num_read == -1) {
                 error (0, errno, "read error");
                 goto err;
@@ -424,6 +430,10 @@ finished:
 err:
         ret = -1;
 out:
+        if (buffer) {
+                buffer_pool_put (buffer, BUFSIZE, false);
+        }
+
         return ret;
 }
 
@@ -465,7 +475,7 @@ tail (glfs_t *fs)
                 goto err;
         }
 
-        ret = gluster_read (fd, STDOUT_FILENO);
+        ret = gluster_read (fd, STDOUT_FILENO, NULL);
         if (ret == -1) {
                 error (0, errno, "write error");
                 goto err;
@@ -495,7 +505,7 @@ tail (glfs_t *fs)
                                 glfs_lseek (fd, 0, SEEK_SET);
                         }
 
-                        ret = gluster_read (fd, STDOUT_FILENO);
+                        ret = gluster_read (fd, STDOUT_FILENO, NULL);
                         if (ret == -1) {
                                 error (0, errno, "read error: %s",
                                                 state->gluster_url->path);
@@ -0,0 +1,285 @@
+/**
+ * Limits on the rate of the data moved by transfers and of the fops they
+ * issue, and on how many fops they keep in flight, so that a bulk copy leaves
+ * the bricks to the other clients of the volume.
+ *
+ * Copyright (C) 2015 Facebook Inc.
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "glfs-transfer-limit.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define NSEC_PER_SEC 1000000000ULL
+
+// How long a bucket may sit idle and still have its credit used at once,
+// and so the largest burst above the rate, in nanoseconds.
+#define LIMIT_BURST (100 * 1000 * 1000ULL)
+
+// Smallest piece of a copy made by the bricks under a byte rate limit.
+#define LIMIT_MIN_CHUNK (64 * 1024)
+
+// Fops let in flight at once before any latency has been measured.
+#define WINDOW_START 2
+
+/**
+ * A token bucket, kept as the time at which it would be full again: every
+ * fop pushes that time back by what it costs at the rate, and may go ahead
+ * once it is no more than the burst ahead of the clock.
+ *
+ * rate: Units per second, or 0 for no limit.
+ * full: Time at which the bucket is full again, in nanoseconds.
+ */
+struct bucket {
+        uint64_t rate;
+        uint64_t full;
+};
+
+/**
+ * The number of fops allowed in flight, grown while they complete within the
+ * target latency and halved when one does not, as TCP does with its
+ * congestion window.
+ *
+ * target: Latency to hold the fops to, in nanoseconds, or 0 for no window.
+ * size: Fops allowed in flight.
+ * inflight: Fops in flight.
+ * credit: Fops completed in time since the window last grew by one.
+ * slow_start: Whether the window still doubles every round trip, as it does
+ *             until the first fop is late.
+ * shrunk: Time at which the window was last halved. Fops that went out before
+ *         then are not held against it again.
+ */
+struct window {
+        uint64_t target;
+        unsigned int size;
+        unsigned int inflight;
+        unsigned int credit;
+        bool slow_start;
+        uint64_t shrunk;
+};
+
+/**
+ * enabled: Whether there are any limits. Only changed while no transfer is
+ *          running, so it is read without the lock.
+ */
+static struct {
+        bool enabled;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        struct bucket bytes;
+        struct bucket fops;
+        struct window window;
+} limit = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static uint64_t
+clock_ns ()
+{
+        struct timespec now;
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+
+        return now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+/**
+ * Takes amount out of bucket at the time now, and returns the time at which
+ * the fop it is for may go ahead.
+ */
+static uint64_t
+take (struct bucket *bucket, uint64_t amount, uint64_t now)
+{
+        if (bucket->rate == 0 || amount == 0) {
+                return now;
+        }
+
+        if (bucket->full < now) {
+                bucket->full = now;
+        }
+
+        bucket->full += amount * NSEC_PER_SEC / bucket->rate;
+
+        return bucket->full > now + LIMIT_BURST ? bucket->full - LIMIT_BURST : now;
+}
+
+/**
+ * Limits the data read by all the transfers of the process together to
+ * bytes_per_second, and the fops they issue to fops_per_second. Unless
+ * target_latency is 0, the number of fops on Gluster they keep in flight is
+ * also adjusted to hold each of them to target_latency nanoseconds. 0 stands
+ * for no limit.
+ */
+void
+transfer_limit_set (uint64_t bytes_per_second, unsigned int fops_per_second,
+                    uint64_t target_latency)
+{
+        uint64_t now = clock_ns ();
+
+        limit.bytes.rate = bytes_per_second;
+        limit.bytes.full = now;
+        limit.fops.rate = fops_per_second;
+        limit.fops.full = now;
+        limit.window.target = target_latency;
+        limit.window.size = WINDOW_START;
+        limit.window.inflight = 0;
+        limit.window.credit = 0;
+        limit.window.slow_start = true;
+        limit.window.shrunk = now;
+        limit.enabled = bytes_per_second > 0 || fops_per_second > 0
+                || target_latency > 0;
+}
+
+/**
+ * Waits until one more fop, which reads bytes, fits within the limits. The
+ * writes pass 0, as the data they carry was accounted for when it was read.
+ * The time is taken out of the buckets up front, so threads waiting at once
+ * are let through one after the other, however many of them there are.
+ */
+void
+transfer_limit (size_t bytes)
+{
+        struct timespec until;
+        uint64_t now;
+        uint64_t start;
+        uint64_t fops_start;
+
+        if (!limit.enabled) {
+                return;
+        }
+
+        now = clock_ns ();
+
+        pthread_mutex_lock (&limit.lock);
+        start = take (&limit.bytes, bytes, now);
+        fops_start = take (&limit.fops, 1, now);
+        pthread_mutex_unlock (&limit.lock);
+
+        if (fops_start > start) {
+                start = fops_start;
+        }
+
+        if (start <= now) {
+                return;
+        }
+
+        until.tv_sec = start / NSEC_PER_SEC;
+        until.tv_nsec = start % NSEC_PER_SEC;
+        while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+                continue;
+        }
+}
+
+/**
+ * Returns how much of a copy made by the bricks to ask for at once, up to
+ * max, so that the copy is held to the byte rate in steps no longer than the
+ * burst allowed.
+ */
+size_t
+transfer_limit_chunk (size_t max)
+{
+        uint64_t chunk;
+
+        if (!limit.enabled || limit.bytes.rate == 0) {
+                return max;
+        }
+
+        chunk = limit.bytes.rate / (NSEC_PER_SEC / LIMIT_BURST);
+        if (chunk < LIMIT_MIN_CHUNK) {
+                chunk = LIMIT_MIN_CHUNK;
+        }
+
+        return chunk < max ? chunk : max;
+}
+
+/**
+ * Waits until the window has room for one more fop on Gluster, and takes it.
+ * Returns the time the fop went out, to be handed to transfer_limit_leave ()
+ * once it completes, or 0 if there is no window to take room in.
+ */
+uint64_t
+transfer_limit_enter ()
+{
+        if (!limit.enabled || limit.window.target == 0) {
+                return 0;
+        }
+
+        pthread_mutex_lock (&limit.lock);
+        while (limit.window.inflight >= limit.window.size) {
+                pthread_cond_wait (&limit.cond, &limit.lock);
+        }
+
+        limit.window.inflight++;
+        pthread_mutex_unlock (&limit.lock);
+
+        // Only the time spent on the fop itself counts, not the wait for room.
+        return clock_ns ();
+}
+
+/**
+ * Gives back the room taken by a fop that went out at entered, and grows or
+ * shrinks the window by how long it took. Growing only while the window is
+ * full keeps it from running away from what the callers actually have in
+ * flight, when there are fewer of them than it allows. errno is left as it
+ * was.
+ */
+void
+transfer_limit_leave (uint64_t entered)
+{
+        struct window *window = &limit.window;
+        int err = errno;
+        uint64_t now;
+        bool full;
+
+        if (entered == 0) {
+                return;
+        }
+
+        now = clock_ns ();
+
+        pthread_mutex_lock (&limit.lock);
+        full = window->inflight >= window->size;
+        window->inflight--;
+
+        if (now - entered > window->target) {
+                if (entered >= window->shrunk) {
+                        window->size = window->size > 1 ? window->size / 2 : 1;
+                        window->credit = 0;
+                        window->slow_start = false;
+                        window->shrunk = now;
+                }
+        } else if (full && window->size < TRANSFER_MAX_WINDOW) {
+                if (window->slow_start) {
+                        window->size++;
+                } else if (++window->credit >= window->size) {
+                        window->size++;
+                        window->credit = 0;
+                }
+        }
+
+        pthread_cond_broadcast (&limit.cond);
+        pthread_mutex_unlock (&limit.lock);
+
+        errno = err;
+}
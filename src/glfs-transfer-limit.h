@@ -0,0 +1,47 @@
+/**
+ * Copyright (C) 2015 Facebook Inc.
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GLFS_TRANSFER_LIMIT_H
+#define GLFS_TRANSFER_LIMIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRANSFER_MAX_IOPS_LIMIT 1000000
+// Upper bounds on the target latency, in nanoseconds, and on the number of
+// fops it lets in flight.
+#define TRANSFER_MAX_TARGET_LATENCY (60 * 1000000000ULL)
+#define TRANSFER_MAX_WINDOW 4096
+
+void
+transfer_limit_set (uint64_t bytes_per_second, unsigned int fops_per_second,
+                    uint64_t target_latency);
+
+void
+transfer_limit (size_t bytes);
+
+size_t
+transfer_limit_chunk (size_t max);
+
+uint64_t
+transfer_limit_enter ();
+
+void
+transfer_limit_leave (uint64_t entered);
+
+#endif /* GLFS_TRANSFER_LIMIT_H */
@@ -0,0 +1,428 @@
+/**
+ * Statistics of the data moved by transfers, for telling whether a transfer
+ * is held back by the client, the network or the bricks.
+ *
+ * Every fop of a transfer is counted along with its latency, and the time
+ * that either stage of the pipeline spends idle is split by what it waited
+ * for. A reporter thread samples the throughput every second, prints a report
+ * every interval if asked to, and a final report is printed when the
+ * statistics are stopped. Reports go to stderr, as text or as one JSON object
+ * per line.
+ *
+ * Copyright (C) 2015 Facebook Inc.
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "glfs-transfer-stats.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Bucket i of a latency histogram counts latencies of [2^(i-1), 2^i)
+// microseconds, bucket 0 those under a microsecond.
+#define LATENCY_BUCKETS 40
+#define MIB (1024.0 * 1024.0)
+
+static const char *fop_names[TRANSFER_FOPS] = {
+        [TRANSFER_FOP_READ] = "read",
+        [TRANSFER_FOP_WRITE] = "write",
+        [TRANSFER_FOP_COPY] = "copy",
+};
+
+/**
+ * max: Highest latency seen, in nanoseconds.
+ */
+struct fop_stats {
+        uint64_t count;
+        uint64_t bytes;
+        uint64_t errors;
+        uint64_t latency[LATENCY_BUCKETS];
+        uint64_t max;
+};
+
+/**
+ * enabled: Whether statistics are being gathered. Only changed while no
+ *          transfer is running, so it is read without the lock.
+ * stalls: Seconds spent waiting for each side of the transfers.
+ * peak: Highest throughput over a one second sample, in bytes per second.
+ * report_time/report_bytes: When the last report was printed and how much
+ *                           had been moved by then.
+ */
+static struct {
+        bool enabled;
+        enum transfer_stats_format format;
+        unsigned int interval;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        pthread_t reporter;
+        bool stopping;
+        struct timespec start;
+        struct fop_stats fops[TRANSFER_FOPS];
+        double stalls[TRANSFER_STALLS];
+        double peak;
+        struct timespec report_time;
+        uint64_t report_bytes;
+} stats = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static double
+seconds_between (const struct timespec *start, const struct timespec *end)
+{
+        return (end->tv_sec - start->tv_sec)
+                + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Must be called with stats.lock held.
+static uint64_t
+bytes_moved ()
+{
+        return stats.fops[TRANSFER_FOP_WRITE].bytes
+                + stats.fops[TRANSFER_FOP_COPY].bytes;
+}
+
+/**
+ * Estimates the latency below which a fraction p of the fops completed, in
+ * microseconds, by interpolating within the histogram bucket it falls in.
+ */
+static double
+percentile (const struct fop_stats *fs, double p)
+{
+        uint64_t target = p * fs->count;
+        uint64_t seen = 0;
+        double max = fs->max / 1e3;
+        double low;
+        double high;
+        int i;
+
+        // The rank of the fop at that fraction, counting from 1.
+        if (target < p * fs->count) {
+                target++;
+        }
+
+        for (i = 0; i < LATENCY_BUCKETS; i++) {
+                if (fs->latency[i] == 0 || seen + fs->latency[i] < target) {
+                        seen += fs->latency[i];
+                        continue;
+                }
+
+                // The slowest fops are known exactly.
+                low = i == 0 ? 0 : (double) (1ULL << (i - 1));
+                high = (double) (1ULL << i);
+                if (high > max) {
+                        high = max;
+                }
+
+                return low + (high - low) * (target - seen) / (double) fs->latency[i];
+        }
+
+        return max;
+}
+
+static void
+report_json (double elapsed, uint64_t bytes, double current, bool final)
+{
+        const struct fop_stats *fs;
+        int fop;
+
+        fprintf (stderr,
+                 "{\"elapsed\": %.3f, \"bytes\": %" PRIu64 ", "
+                 "\"throughput\": {\"current\": %.0f, \"average\": %.0f, \"peak\": %.0f}, "
+                 "\"fops\": {",
+                 elapsed, bytes, current,
+                 elapsed > 0 ? bytes / elapsed : 0, stats.peak);
+
+        for (fop = 0; fop < TRANSFER_FOPS; fop++) {
+                fs = &stats.fops[fop];
+                fprintf (stderr,
+                         "%s\"%s\": {\"count\": %" PRIu64 ", \"bytes\": %" PRIu64 ", "
+                         "\"errors\": %" PRIu64 ", \"latency_us\": "
+                         "{\"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}}",
+                         fop == 0 ? "" : ", ", fop_names[fop],
+                         fs->count, fs->bytes, fs->errors,
+                         percentile (fs, 0.5), percentile (fs, 0.99),
+                         fs->max / 1e3);
+        }
+
+        fprintf (stderr,
+                 "}, \"stalls\": {\"source\": %.3f, \"destination\": %.3f}, "
+                 "\"final\": %s}\n",
+                 stats.stalls[TRANSFER_STALL_SOURCE],
+                 stats.stalls[TRANSFER_STALL_DEST],
+                 final ? "true" : "false");
+}
+
+static void
+report_text (double elapsed, uint64_t bytes, double current, bool final)
+{
+        const struct fop_stats *fs;
+        int fop;
+
+        if (!final) {
+                fprintf (stderr,
+                         "%s: %" PRIu64 " bytes in %.0f s, %.1f MiB/s now, "
+                         "%.1f MiB/s average\n",
+                         program_invocation_name, bytes, elapsed,
+                         current / MIB,
+                         elapsed > 0 ? bytes / elapsed / MIB : 0);
+                return;
+        }
+
+        fprintf (stderr, "%s: %" PRIu64 " bytes in %.2f s, %.1f MiB/s (peak %.1f MiB/s)\n",
+                 program_invocation_name, bytes, elapsed,
+                 elapsed > 0 ? bytes / elapsed / MIB : 0, stats.peak / MIB);
+
+        for (fop = 0; fop < TRANSFER_FOPS; fop++) {
+                fs = &stats.fops[fop];
+                if (fs->count == 0) {
+                        continue;
+                }
+
+                fprintf (stderr,
+                         "%s: %s: %" PRIu64 " fops, %" PRIu64 " errors, "
+                         "latency p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+                         program_invocation_name, fop_names[fop],
+                         fs->count, fs->errors,
+                         percentile (fs, 0.5) / 1e3,
+                         percentile (fs, 0.99) / 1e3,
+                         fs->max / 1e6);
+        }
+
+        fprintf (stderr, "%s: waited %.2f s for the source and %.2f s for the destination\n",
+                 program_invocation_name,
+                 stats.stalls[TRANSFER_STALL_SOURCE],
+                 stats.stalls[TRANSFER_STALL_DEST]);
+}
+
+// Must be called with stats.lock held.
+static void
+report (bool final)
+{
+        struct timespec now;
+        uint64_t bytes = bytes_moved ();
+        double elapsed;
+        double current = 0;
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        elapsed = seconds_between (&stats.start, &now);
+        if (seconds_between (&stats.report_time, &now) > 0) {
+                current = (bytes - stats.report_bytes)
+                        / seconds_between (&stats.report_time, &now);
+        }
+
+        // A transfer shorter than a sample still had a throughput.
+        if (final && elapsed > 0 && bytes / elapsed > stats.peak) {
+                stats.peak = bytes / elapsed;
+        }
+
+        if (stats.format == TRANSFER_STATS_JSON) {
+                report_json (elapsed, bytes, current, final);
+        } else {
+                report_text (elapsed, bytes, current, final);
+        }
+
+        stats.report_time = now;
+        stats.report_bytes = bytes;
+}
+
+static void *
+reporter (void *data)
+{
+        struct timespec deadline;
+        uint64_t sampled = 0;
+        unsigned int ticks = 0;
+        int ret;
+
+        pthread_mutex_lock (&stats.lock);
+        deadline = stats.start;
+        deadline.tv_sec++;
+        while (!stats.stopping) {
+                ret = pthread_cond_timedwait (&stats.cond, &stats.lock, &deadline);
+                if (ret != ETIMEDOUT) {
+                        continue;
+                }
+
+                if (bytes_moved () - sampled > stats.peak) {
+                        stats.peak = bytes_moved () - sampled;
+                }
+
+                sampled = bytes_moved ();
+                deadline.tv_sec++;
+
+                if (stats.interval != 0 && ++ticks % stats.interval == 0) {
+                        report (false);
+                }
+        }
+        pthread_mutex_unlock (&stats.lock);
+
+        return NULL;
+}
+
+/**
+ * Starts gathering statistics, reported in format, or as text if only an
+ * interval is given, and every interval seconds if that isn't 0. Does nothing
+ * if neither is given. Returns 0 on success, or -1 with errno set.
+ */
+int
+transfer_stats_start (enum transfer_stats_format format, unsigned int interval)
+{
+        pthread_condattr_t attr;
+        int ret;
+
+        if (format == TRANSFER_STATS_NONE && interval == 0) {
+                return 0;
+        }
+
+        stats.format = format == TRANSFER_STATS_NONE ? TRANSFER_STATS_TEXT : format;
+        stats.interval = interval;
+        stats.stopping = false;
+        memset (stats.fops, 0, sizeof (stats.fops));
+        memset (stats.stalls, 0, sizeof (stats.stalls));
+        stats.peak = 0;
+        stats.report_bytes = 0;
+        clock_gettime (CLOCK_MONOTONIC, &stats.start);
+        stats.report_time = stats.start;
+
+        pthread_condattr_init (&attr);
+        pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+        pthread_cond_init (&stats.cond, &attr);
+        pthread_condattr_destroy (&attr);
+
+        ret = pthread_create (&stats.reporter, NULL, reporter, NULL);
+        if (ret != 0) {
+                pthread_cond_destroy (&stats.cond);
+                errno = ret;
+                return -1;
+        }
+
+        stats.enabled = true;
+
+        return 0;
+}
+
+/**
+ * Stops gathering statistics and prints the final report, if they were
+ * started.
+ */
+void
+transfer_stats_stop ()
+{
+        if (!stats.enabled) {
+                return;
+        }
+
+        pthread_mutex_lock (&stats.lock);
+        stats.stopping = true;
+        pthread_cond_signal (&stats.cond);
+        pthread_mutex_unlock (&stats.lock);
+
+        pthread_join (stats.reporter, NULL);
+
+        pthread_mutex_lock (&stats.lock);
+        report (true);
+        pthread_mutex_unlock (&stats.lock);
+
+        pthread_cond_destroy (&stats.cond);
+        stats.enabled = false;
+}
+
+/**
+ * Reads the clock for the start of a fop or a stall, if statistics are being
+ * gathered.
+ */
+void
+transfer_stats_clock (struct timespec *now)
+{
+        if (stats.enabled) {
+                clock_gettime (CLOCK_MONOTONIC, now);
+        }
+}
+
+/**
+ * Accounts for a fop that returned ret and was started at start. errno is
+ * left as it was.
+ */
+void
+transfer_stats_fop (enum transfer_fop fop, ssize_t ret, const struct timespec *start)
+{
+        struct fop_stats *fs = &stats.fops[fop];
+        struct timespec now;
+        uint64_t latency;
+        uint64_t usecs;
+        int bucket = 0;
+        int err = errno;
+
+        if (!stats.enabled) {
+                return;
+        }
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        latency = (now.tv_sec - start->tv_sec) * 1000000000ULL
+                + now.tv_nsec - start->tv_nsec;
+
+        for (usecs = latency / 1000; usecs != 0; usecs >>= 1) {
+                bucket++;
+        }
+
+        if (bucket >= LATENCY_BUCKETS) {
+                bucket = LATENCY_BUCKETS - 1;
+        }
+
+        pthread_mutex_lock (&stats.lock);
+        fs->count++;
+        if (ret < 0) {
+                fs->errors++;
+        } else {
+                fs->bytes += ret;
+        }
+
+        fs->latency[bucket]++;
+        if (latency > fs->max) {
+                fs->max = latency;
+        }
+        pthread_mutex_unlock (&stats.lock);
+
+        // Callers still have to look at the errno of the fop.
+        errno = err;
+}
+
+/**
+ * Accounts for time since start that a stage of a transfer spent waiting for
+ * the given side.
+ */
+void
+transfer_stats_stall (enum transfer_stall stall, const struct timespec *start)
+{
+        struct timespec now;
+
+        if (!stats.enabled) {
+                return;
+        }
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+
+        pthread_mutex_lock (&stats.lock);
+        stats.stalls[stall] += seconds_between (start, &now);
+        pthread_mutex_unlock (&stats.lock);
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) 2015 Facebook Inc.
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GLFS_TRANSFER_STATS_H
+#define GLFS_TRANSFER_STATS_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#define TRANSFER_MAX_STATS_INTERVAL 3600
+
+enum transfer_stats_format {
+        TRANSFER_STATS_NONE,
+        TRANSFER_STATS_TEXT,
+        TRANSFER_STATS_JSON
+};
+
+/**
+ * The fops whose latency is tracked. TRANSFER_FOP_COPY is a copy made by the
+ * bricks themselves.
+ */
+enum transfer_fop {
+        TRANSFER_FOP_READ,
+        TRANSFER_FOP_WRITE,
+        TRANSFER_FOP_COPY,
+        TRANSFER_FOPS
+};
+
+/**
+ * What a stage of a transfer was waiting for while it had nothing to do.
+ */
+enum transfer_stall {
+        TRANSFER_STALL_SOURCE,
+        TRANSFER_STALL_DEST,
+        TRANSFER_STALLS
+};
+
+int
+transfer_stats_start (enum transfer_stats_format format, unsigned int interval);
+
+void
+transfer_stats_stop ();
+
+void
+transfer_stats_clock (struct timespec *now);
+
+void
+transfer_stats_fop (enum transfer_fop fop, ssize_t ret, const struct timespec *start);
+
+void
+transfer_stats_stall (enum transfer_stall stall, const struct timespec *start);
+
+#endif /* GLFS_TRANSFER_STATS_H */
@@ -0,0 +1,513 @@
+/**
+ * Asynchronous reads and writes of local files through io_uring, for the
+ * local side of a transfer to keep several fops in flight the way the
+ * Gluster side does with the asynchronous fops of libgfapi.
+ *
+ * Fops are queued on the ring as they come and only submitted when asked,
+ * so that a stage of a transfer hands the kernel everything it has queued in
+ * one system call before it goes to sleep. The transfer buffers are
+ * registered with the kernel up front where the memory lock limit allows,
+ * which saves mapping their pages on every fop. A thread of the ring's own
+ * reaps the completions and hands them to the callbacks of the fops.
+ *
+ * Without liburing, transfer_uring_create () fails with ENOSYS and local
+ * files are read and written with blocking calls instead.
+ *
+ * Copyright (C) 2015 Facebook Inc.
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "glfs-transfer-uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#ifdef HAVE_LIBURING
+
+#include <liburing.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+/**
+ * A fop handed to the ring, and what to call once it is done. next links the
+ * requests that are free, and those queued but not submitted yet. busy tells
+ * the requests whose fop has yet to complete.
+ */
+struct uring_request {
+        transfer_uring_done_t done;
+        void *data;
+        struct uring_request *next;
+        bool busy;
+};
+
+/**
+ * lock: Held while entries are queued and submitted, and over the lists of
+ *       requests.
+ * requests/nrequests: All the requests of the ring.
+ * free: Requests not in use.
+ * queued/last: Requests queued but not submitted yet, oldest first.
+ * fixed: Whether bufs are registered with the kernel.
+ * broken: The ring failed to take its entries, and takes no more.
+ */
+struct transfer_uring {
+        struct io_uring ring;
+        pthread_mutex_t lock;
+        pthread_t reaper;
+        struct uring_request *requests;
+        unsigned int nrequests;
+        struct uring_request *free;
+        struct uring_request *queued;
+        struct uring_request *last;
+        char **bufs;
+        unsigned int nbufs;
+        size_t buf_size;
+        bool fixed;
+        bool broken;
+};
+
+static void
+finish (transfer_uring_done_t done, void *data, int res)
+{
+        if (res < 0) {
+                errno = -res;
+                done (-1, data);
+        } else {
+                done (res, data);
+        }
+}
+
+/**
+ * Completes every fop of uring that is still in flight or queued with the
+ * error err, once the ring can no longer be waited on, and takes no more.
+ */
+static void
+fail_requests (struct transfer_uring *uring, int err)
+{
+        struct uring_request *failed = NULL;
+        struct uring_request *req;
+        unsigned int i;
+
+        pthread_mutex_lock (&uring->lock);
+        uring->broken = true;
+        uring->queued = NULL;
+        uring->last = NULL;
+
+        for (i = 0; i < uring->nrequests; i++) {
+                req = &uring->requests[i];
+                if (req->busy) {
+                        req->busy = false;
+                        req->next = failed;
+                        failed = req;
+                }
+        }
+        pthread_mutex_unlock (&uring->lock);
+
+        // The requests stay off the free list meanwhile, although a broken
+        // ring takes no more fops anyway.
+        for (req = failed; req; req = req->next) {
+                finish (req->done, req->data, -err);
+        }
+
+        pthread_mutex_lock (&uring->lock);
+        while (failed) {
+                req = failed;
+                failed = req->next;
+                req->next = uring->free;
+                uring->free = req;
+        }
+        pthread_mutex_unlock (&uring->lock);
+}
+
+/**
+ * Hands each completion of the ring to the callback of its fop, until the
+ * entry queued by transfer_uring_destroy (), which carries no request, comes
+ * back. Should the ring fail, the fops still on it are failed instead, so
+ * that nobody waits for them forever.
+ */
+static void *
+reap (void *arg)
+{
+        struct transfer_uring *uring = arg;
+        struct io_uring_cqe *cqe = NULL;
+        struct uring_request *req;
+        transfer_uring_done_t done;
+        void *data;
+        int res;
+
+        while (true) {
+                res = io_uring_wait_cqe (&uring->ring, &cqe);
+                if (res == -EINTR) {
+                        continue;
+                } else if (res < 0) {
+                        fail_requests (uring, -res);
+                        break;
+                }
+
+                req = io_uring_cqe_get_data (cqe);
+                res = cqe->res;
+                io_uring_cqe_seen (&uring->ring, cqe);
+
+                if (req == NULL) {
+                        break;
+                }
+
+                pthread_mutex_lock (&uring->lock);
+                done = req->done;
+                data = req->data;
+                req->busy = false;
+                req->next = uring->free;
+                uring->free = req;
+                pthread_mutex_unlock (&uring->lock);
+
+                finish (done, data, res);
+        }
+
+        return NULL;
+}
+
+/**
+ * Registers the buffers of uring with the kernel. Failing to is no reason not
+ * to use the ring, as it is usually down to the memory lock limit.
+ */
+static void
+register_buffers (struct transfer_uring *uring)
+{
+        struct iovec *iovecs;
+        unsigned int i;
+
+        iovecs = calloc (uring->nbufs, sizeof (*iovecs));
+        if (iovecs == NULL) {
+                return;
+        }
+
+        for (i = 0; i < uring->nbufs; i++) {
+                iovecs[i].iov_base = uring->bufs[i];
+                iovecs[i].iov_len = uring->buf_size;
+        }
+
+        uring->fixed = io_uring_register_buffers (&uring->ring, iovecs,
+                                                  uring->nbufs) == 0;
+        free (iovecs);
+}
+
+/**
+ * Returns a ring for up to depth reads and depth writes in flight at once, on
+ * files that are read into and written from the nbufs buffers of buf_size
+ * bytes in bufs, or from anywhere else at a small cost. Returns NULL with
+ * errno set if the kernel offers no io_uring.
+ */
+struct transfer_uring *
+transfer_uring_create (unsigned int depth, char *const *bufs, unsigned int nbufs,
+                       size_t buf_size)
+{
+        struct transfer_uring *uring;
+        unsigned int nrequests = 2 * depth;
+        unsigned int i;
+        int ret;
+
+        uring = calloc (1, sizeof (*uring));
+        if (uring == NULL) {
+                return NULL;
+        }
+
+        uring->requests = calloc (nrequests, sizeof (*uring->requests));
+        uring->bufs = calloc (nbufs, sizeof (*uring->bufs));
+        if (uring->requests == NULL || uring->bufs == NULL) {
+                goto err;
+        }
+
+        // One more entry for the one that stops the completion thread.
+        ret = io_uring_queue_init (nrequests + 1, &uring->ring, 0);
+        if (ret < 0) {
+                errno = -ret;
+                goto err;
+        }
+
+        for (i = 0; i < nrequests; i++) {
+                uring->requests[i].next = uring->free;
+                uring->free = &uring->requests[i];
+        }
+
+        uring->nrequests = nrequests;
+
+        for (i = 0; i < nbufs; i++) {
+                uring->bufs[i] = bufs[i];
+        }
+
+        uring->nbufs = nbufs;
+        uring->buf_size = buf_size;
+        register_buffers (uring);
+
+        pthread_mutex_init (&uring->lock, NULL);
+        ret = pthread_create (&uring->reaper, NULL, reap, uring);
+        if (ret != 0) {
+                pthread_mutex_destroy (&uring->lock);
+                io_uring_queue_exit (&uring->ring);
+                errno = ret;
+                goto err;
+        }
+
+        return uring;
+
+err:
+        free (uring->bufs);
+        free (uring->requests);
+        free (uring);
+
+        return NULL;
+}
+
+/**
+ * Stops the completion thread of uring and frees it. Every fop on it must
+ * have completed. A ring that won't take the entry that stops the thread is
+ * left to it.
+ */
+void
+transfer_uring_destroy (struct transfer_uring *uring)
+{
+        struct io_uring_sqe *sqe;
+        int ret = -1;
+
+        if (uring == NULL) {
+                return;
+        }
+
+        pthread_mutex_lock (&uring->lock);
+        sqe = uring->broken ? NULL : io_uring_get_sqe (&uring->ring);
+        if (sqe) {
+                io_uring_prep_nop (sqe);
+                io_uring_sqe_set_data (sqe, NULL);
+                do {
+                        ret = io_uring_submit (&uring->ring);
+                } while (ret == -EINTR || ret == -EAGAIN || ret == -EBUSY);
+        }
+        pthread_mutex_unlock (&uring->lock);
+
+        if (ret < 0) {
+                pthread_detach (uring->reaper);
+                return;
+        }
+
+        pthread_join (uring->reaper, NULL);
+        pthread_mutex_destroy (&uring->lock);
+        io_uring_queue_exit (&uring->ring);
+        free (uring->bufs);
+        free (uring->requests);
+        free (uring);
+}
+
+/**
+ * Returns the index of the registered buffer that buf points into, or -1.
+ */
+static int
+buf_index (const struct transfer_uring *uring, const char *buf)
+{
+        unsigned int i;
+
+        for (i = 0; uring->fixed && i < uring->nbufs; i++) {
+                if (buf >= uring->bufs[i] && buf < uring->bufs[i] + uring->buf_size) {
+                        return i;
+                }
+        }
+
+        return -1;
+}
+
+static int
+queue (struct transfer_uring *uring, bool write, int fd, char *buf, size_t count,
+       off_t offset, transfer_uring_done_t done, void *data)
+{
+        struct io_uring_sqe *sqe = NULL;
+        struct uring_request *req;
+        int index;
+        int err = EAGAIN;
+
+        // A ring short of requests or entries is only full for now.
+        pthread_mutex_lock (&uring->lock);
+        req = uring->free;
+        if (uring->broken) {
+                err = EIO;
+        } else if (req != NULL) {
+                sqe = io_uring_get_sqe (&uring->ring);
+        }
+
+        if (sqe == NULL) {
+                pthread_mutex_unlock (&uring->lock);
+                errno = err;
+                return -1;
+        }
+
+        uring->free = req->next;
+        req->done = done;
+        req->data = data;
+        req->next = NULL;
+        req->busy = true;
+
+        index = buf_index (uring, buf);
+        if (write && index >= 0) {
+                io_uring_prep_write_fixed (sqe, fd, buf, count, offset, index);
+        } else if (write) {
+                io_uring_prep_write (sqe, fd, buf, count, offset);
+        } else if (index >= 0) {
+                io_uring_prep_read_fixed (sqe, fd, buf, count, offset, index);
+        } else {
+                io_uring_prep_read (sqe, fd, buf, count, offset);
+        }
+
+        io_uring_sqe_set_data (sqe, req);
+
+        if (uring->last) {
+                uring->last->next = req;
+        } else {
+                uring->queued = req;
+        }
+
+        uring->last = req;
+        pthread_mutex_unlock (&uring->lock);
+
+        return 0;
+}
+
+/**
+ * Queues a read of count bytes of fd at offset into buf, for done to be
+ * called with data once it completes. Nothing happens until the next
+ * transfer_uring_submit (). Returns 0, or -1 with errno set if the fop can't
+ * be queued, in which case done is never called.
+ */
+int
+transfer_uring_read (struct transfer_uring *uring, int fd, char *buf, size_t count,
+                     off_t offset, transfer_uring_done_t done, void *data)
+{
+        return queue (uring, false, fd, buf, count, offset, done, data);
+}
+
+/**
+ * Queues a write of count bytes of buf to fd at offset, as with
+ * transfer_uring_read ().
+ */
+int
+transfer_uring_write (struct transfer_uring *uring, int fd, const char *buf,
+                      size_t count, off_t offset, transfer_uring_done_t done,
+                      void *data)
+{
+        return queue (uring, true, fd, (char *) buf, count, offset, done, data);
+}
+
+/**
+ * Submits the fops queued on uring. Returns the number submitted, or -1 with
+ * errno set if the ring failed to take them, in which case they complete with
+ * that error before this returns.
+ */
+int
+transfer_uring_submit (struct transfer_uring *uring)
+{
+        struct uring_request *failed = NULL;
+        struct uring_request *req;
+        int submitted = 0;
+        int err = 0;
+        int ret;
+
+        pthread_mutex_lock (&uring->lock);
+        while (uring->queued) {
+                ret = io_uring_submit (&uring->ring);
+                if (ret == 0 || ret == -EINTR || ret == -EAGAIN || ret == -EBUSY) {
+                        // The completion thread makes room as it goes.
+                        pthread_mutex_unlock (&uring->lock);
+                        sched_yield ();
+                        pthread_mutex_lock (&uring->lock);
+                        continue;
+                } else if (ret < 0) {
+                        // The entries are still on the ring, so it can't be
+                        // used again without sending them after all.
+                        uring->broken = true;
+                        failed = uring->queued;
+                        uring->queued = NULL;
+                        for (req = failed; req; req = req->next) {
+                                req->busy = false;
+                        }
+
+                        err = -ret;
+                        break;
+                }
+
+                submitted += ret;
+                while (ret-- > 0 && uring->queued) {
+                        uring->queued = uring->queued->next;
+                }
+        }
+
+        uring->last = NULL;
+        pthread_mutex_unlock (&uring->lock);
+
+        if (failed == NULL) {
+                return submitted;
+        }
+
+        while (failed) {
+                req = failed;
+                failed = req->next;
+                finish (req->done, req->data, -err);
+        }
+
+        errno = err;
+
+        return -1;
+}
+
+#else /* HAVE_LIBURING */
+
+struct transfer_uring *
+transfer_uring_create (unsigned int depth, char *const *bufs, unsigned int nbufs,
+                       size_t buf_size)
+{
+        errno = ENOSYS;
+        return NULL;
+}
+
+void
+transfer_uring_destroy (struct transfer_uring *uring)
+{
+}
+
+int
+transfer_uring_read (struct transfer_uring *uring, int fd, char *buf, size_t count,
+                     off_t offset, transfer_uring_done_t done, void *data)
+{
+        errno = ENOSYS;
+        return -1;
+}
+
+int
+transfer_uring_write (struct transfer_uring *uring, int fd, const char *buf,
+                      size_t count, off_t offset, transfer_uring_done_t done,
+                      void *data)
+{
+        errno = ENOSYS;
+        return -1;
+}
+
+int
+transfer_uring_submit (struct transfer_uring *uring)
+{
+        errno = ENOSYS;
+        return -1;
+}
+
+#endif /* HAVE_LIBURING */
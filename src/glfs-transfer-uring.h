@@ -0,0 +1,52 @@
+/**
+ * Copyright (C) 2015 Facebook Inc.
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GLFS_TRANSFER_URING_H
+#define GLFS_TRANSFER_URING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct transfer_uring;
+
+/**
+ * Called from the completion thread of the ring once a read or write is
+ * done, with the number of bytes moved, or -1 with errno set.
+ */
+typedef void (*transfer_uring_done_t)(ssize_t ret, void *data);
+
+struct transfer_uring *
+transfer_uring_create (unsigned int depth, char *const *bufs, unsigned int nbufs,
+                       size_t buf_size);
+
+void
+transfer_uring_destroy (struct transfer_uring *uring);
+
+int
+transfer_uring_read (struct transfer_uring *uring, int fd, char *buf, size_t count,
+                     off_t offset, transfer_uring_done_t done, void *data);
+
+int
+transfer_uring_write (struct transfer_uring *uring, int fd, const char *buf,
+                      size_t count, off_t offset, transfer_uring_done_t done,
+                      void *data);
+
+int
+transfer_uring_submit (struct transfer_uring *uring);
+
+#endif /* GLFS_TRANSFER_URING_H */
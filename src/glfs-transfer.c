@@ -0,0 +1,3045 @@
+/**
+ * A pipelined engine for moving data between local files and files on a
+ * Gluster volume.
+ *
+ * A transfer is split into two stages that run concurrently: a reader thread
+ * that fills buffers from the source, and a writer (the calling thread) that
+ * drains them into the destination. The stages share a small ring of buffers;
+ * when the ring is full the reader blocks until the writer frees a slot, and
+ * when it is empty the writer blocks until the reader fills one. This keeps
+ * both the network and the local disk busy at the same time instead of
+ * alternating between them.
+ *
+ * With a queue depth above one, the Gluster side(s) of the transfer switch to
+ * offset-addressed glfs_pread_async/glfs_pwrite_async calls so that several
+ * fops are in flight on the bricks at once. Reads may then complete out of
+ * order, so every slot carries its own state and the writer still consumes
+ * them strictly in ring order. Local regular files can be read and written
+ * the same way through io_uring, so that a slow local disk does not hold up
+ * the Gluster side.
+ *
+ * A local regular file on the other side of a Gluster one can be mapped into
+ * memory instead, for the Gluster fops to read straight from its pages or
+ * write straight into them, which saves copying every byte through a buffer
+ * on the way. A file that is downloaded is extended to its final size up
+ * front. The mapping is unmapped a window at a time behind the writer, so that
+ * a large file doesn't have to fit in the address space, nor its pages pile up
+ * in the process.
+ *
+ * A transfer can also keep its local files out of the page cache, so that a
+ * large copy doesn't evict what other processes on the host work with. A
+ * local regular file is then read and written with O_DIRECT where its file
+ * system allows it, or else has its pages written back and dropped a window
+ * at a time behind the transfer.
+ *
+ * A parallel transfer splits a single file into byte ranges and runs several
+ * such pipelines at once, each over its own pair of fds, to go beyond what one
+ * stream can sustain.
+ *
+ * Regular files with holes are copied extent by extent, found with
+ * SEEK_DATA/SEEK_HOLE, into a destination that starts out as one big hole.
+ *
+ * Within a single volume, glfs_copy_file_range lets the bricks copy the data
+ * among themselves so that it never has to cross the client's network.
+ *
+ * Every fop is timed for the transfer statistics, as is the time either stage
+ * spends waiting for the other.
+ *
+ * Reads and writes are made in blocks of up to one buffer. With an automatic
+ * block size, the first blocks are sized to whole stripes of the volumes and
+ * whole blocks of the files involved; the writer then keeps doubling or halving
+ * the block size for as long as that raises the measured throughput.
+ *
+ * A disperse volume has to read back and re-encode every stripe that is only
+ * partly written, so the blocks written to one are made of whole stripes,
+ * and start on a stripe boundary. Whatever a source such as a pipe
+ * hands over is gathered until it makes up a whole block, so that only the
+ * last one can be short.
+ *
+ * The writer can also checksum the data (CRC32C) on its way through, without
+ * an extra pass over it. Holes and the byte ranges of a parallel transfer get
+ * checksums of their own, which are combined in file order at the end.
+ *
+ * A resumable copy keeps a journal of the ranges that made it to the
+ * destination along with their checksums, so that a later run only has to
+ * read those back to check them, and copies the rest.
+ *
+ * A delta transfer reads each block back from where it is about to be
+ * written, and leaves it alone if the destination holds the same bytes there
+ * already, which trades a read for every write that it saves.
+ *
+ * Copyright (C) 2015 Facebook Inc.
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "glfs-crc32c.h"
+#include "glfs-transfer.h"
+#include "glfs-transfer-uring.h"
+#include "glfs-util.h"
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <glusterfs/api/glfs.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// A block size is judged on at least this much time and this many blocks, and
+// must beat the previous one by TUNE_MIN_GAIN to count as an improvement.
+#define TUNE_WINDOW_SECS 0.25
+#define TUNE_WINDOW_BLOCKS 8
+#define TUNE_MIN_GAIN 1.05
+
+// The pages of a mapped file are unmapped in batches of this many bytes once
+// the writer is done with them.
+#define MAP_WINDOW (64 * 1024 * 1024)
+
+// Offsets and sizes of O_DIRECT I/O are kept to multiples of this, which
+// covers the logical block size of about every device.
+#define DIRECT_ALIGN 4096
+
+// The pages of a local file that bypasses the page cache without O_DIRECT
+// are written back and dropped in batches of this many bytes.
+#define DROP_WINDOW (8 * 1024 * 1024)
+
+enum slot_state {
+        SLOT_FREE,
+        SLOT_READING,
+        SLOT_FULL,
+        SLOT_WRITING,
+        SLOT_RETRY
+};
+
+/**
+ * A single buffer in the ring.
+ *
+ * len: Number of valid bytes in buf.
+ * want: Number of bytes requested by a positional read.
+ * done: Number of bytes already written by asynchronous writes.
+ * offset: Source offset of a positional read.
+ * dest_offset: Destination offset of an asynchronous write.
+ * submitted: When the asynchronous fop in flight was submitted.
+ * entered: What transfer_limit_enter () returned for that fop.
+ */
+struct transfer_slot {
+        struct transfer *xfer;
+        char *buf;
+        size_t len;
+        size_t want;
+        size_t done;
+        off_t offset;
+        off_t dest_offset;
+        struct timespec submitted;
+        uint64_t entered;
+        enum slot_state state;
+};
+
+/**
+ * Tuning state of an automatic block size, which climbs through the power of
+ * two multiples of min in the direction that raises the throughput.
+ *
+ * enabled: Whether the block size is still being tuned.
+ * min/max: Smallest and largest block size to try.
+ * direction: 1 while trying larger blocks, -1 while trying smaller ones.
+ * reversals: Number of times the direction changed; tuning stops at two.
+ * start/start_total: Time and transfer total at the start of the current
+ *                    measurement.
+ * rate: Throughput of the previous block size, in bytes per second.
+ */
+struct autotune {
+        bool enabled;
+        size_t min;
+        size_t max;
+        int direction;
+        unsigned int reversals;
+        struct timespec start;
+        off_t start_total;
+        double rate;
+};
+
+/**
+ * The part of a local file that is mapped into memory.
+ *
+ * base: Start of the mapping, or NULL.
+ * start/end: Offsets of the file that the mapping starts and ends at; start
+ *            is a multiple of page_size.
+ * released: Offset that the mapping was unmapped up to.
+ * shift: Offset in the file of offset 0 of the source.
+ * size: Size of a destination before it was extended to end.
+ */
+struct transfer_map {
+        char *base;
+        off_t start;
+        off_t end;
+        off_t released;
+        off_t shift;
+        off_t size;
+        long page_size;
+};
+
+/**
+ * How a local file of a transfer is kept out of the page cache: with O_DIRECT
+ * set on its fd, or else by dropping its pages behind the transfer.
+ *
+ * flags: File status flags that the fd came with, or -1 if it is left alone.
+ * direct: Whether O_DIRECT is set on the fd.
+ * drop: Whether the pages of the file are dropped as the transfer goes.
+ * dirty: Whether the file is written, so that its pages have to be written
+ *        back before they can be dropped.
+ * start: Offset of the file that the transfer started at.
+ * flushed: Offset up to which writeback was started.
+ * dropped: Offset up to which the pages were dropped.
+ */
+struct transfer_cache {
+        int flags;
+        bool direct;
+        bool drop;
+        bool dirty;
+        off_t start;
+        off_t flushed;
+        off_t dropped;
+};
+
+/**
+ * State shared between the reader, the writer and the completion callbacks
+ * of asynchronous fops. Everything below lock is protected by it.
+ *
+ * buffer_size: Size of the buffer of each slot.
+ * io_uring: Whether the local side, if it is a regular file, is to be read
+ *           or written asynchronously through io_uring.
+ * uring: The ring that it is, if one could be set up.
+ * map_read/map_write: Whether the local source or destination is mapped,
+ *                     for the other side to use the mapping as its buffers.
+ * map: The mapping, which only the reader changes until the end.
+ * src_cache/dst_cache: How local regular files are kept out of the page
+ *                      cache. The reader and the writer respectively clear
+ *                      O_DIRECT, and the writer drops the pages of both.
+ * block_size: Size of the reads handed out from now on, at most buffer_size.
+ * issued: Number of slots handed out by the reader so far.
+ * consumed: Number of slots taken by the writer so far.
+ * reading/writing: Asynchronous fops currently in flight, or queued on the
+ *                  ring.
+ * unsubmitted: Fops queued on the ring since it was last flushed.
+ * retries: Slots whose asynchronous write completed short.
+ * read_offset/read_end: Next and last offset of a positional source.
+ * head: Size of the first block, if it is to end on a stripe boundary of the
+ *       destination, or 0.
+ * gather: Whether the reader fills every block of a streamed source.
+ * write_offset: Next offset of a positional destination.
+ * eof: The reader will not hand out any more slots.
+ * total: Number of bytes handed to the destination.
+ * checksum: CRC32C of the data handed to the destination so far, or NULL.
+ * delta: Whether blocks that the destination already holds are left alone.
+ * scratch: Buffer that destination blocks are read into to compare them.
+ * truncated: The source ended before its expected size.
+ * error: errno of the first failure on either side, or 0.
+ */
+struct transfer {
+        struct transfer_endpoint *src;
+        struct transfer_endpoint *dst;
+        struct transfer_slot *slots;
+        unsigned int nslots;
+        size_t buffer_size;
+        bool huge_pages;
+        unsigned int queue_depth;
+        bool positional_read;
+        bool positional_write;
+        bool async_read;
+        bool async_write;
+        bool io_uring;
+        struct transfer_uring *uring;
+        bool map_read;
+        bool map_write;
+        struct transfer_map map;
+        struct transfer_cache src_cache;
+        struct transfer_cache dst_cache;
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        size_t block_size;
+        struct autotune tune;
+        uint64_t issued;
+        uint64_t consumed;
+        unsigned int reading;
+        unsigned int writing;
+        unsigned int unsubmitted;
+        unsigned int retries;
+        off_t read_offset;
+        off_t read_end;
+        size_t head;
+        bool gather;
+        off_t write_offset;
+        off_t total;
+        uint32_t *checksum;
+        bool delta;
+        char *scratch;
+        bool eof;
+        bool truncated;
+        int error;
+};
+
+void
+transfer_options_init (struct transfer_options *options)
+{
+        options->queue_depth = 1;
+        options->jobs = 1;
+        options->brick_jobs = 0;
+        options->connections = 1;
+        options->buffer_size = 0;
+        options->buffers = 0;
+        options->huge_pages = false;
+        options->block_size = 0;
+        options->auto_block_size = false;
+        options->stats = TRANSFER_STATS_NONE;
+        options->stats_interval = 0;
+        options->verify = false;
+        options->checksum_file = NULL;
+        options->checksum = NULL;
+        options->journal = NULL;
+        options->delta = false;
+        options->bwlimit = 0;
+        options->iops_limit = 0;
+        options->target_latency = 0;
+        options->io_uring = false;
+        options->mmap = false;
+        options->direct = false;
+}
+
+/**
+ * Parses a decimal count between 1 and max. Returns 0 on success or -1 if arg
+ * is not such a number.
+ */
+static int
+parse_count (const char *arg, long max, unsigned int *count)
+{
+        long value;
+        char *end;
+
+        errno = 0;
+        value = strtol (arg, &end, 10);
+        if (errno != 0 || arg == end || *end != '\0' || value < 1 || value > max) {
+                return -1;
+        }
+
+        *count = value;
+
+        return 0;
+}
+
+/**
+ * Parses a latency, in milliseconds unless it ends in us, ms or s, into
+ * nanoseconds between 1 microsecond and TRANSFER_MAX_TARGET_LATENCY. Returns
+ * 0 on success or -1 if arg is not such a latency.
+ */
+static int
+parse_latency (const char *arg, uint64_t *latency)
+{
+        double value;
+        double unit = 1e6;
+        char *end;
+
+        errno = 0;
+        value = strtod (arg, &end);
+        if (errno != 0 || arg == end) {
+                return -1;
+        }
+
+        if (strcmp (end, "us") == 0) {
+                unit = 1e3;
+        } else if (strcmp (end, "s") == 0) {
+                unit = 1e9;
+        } else if (*end != '\0' && strcmp (end, "ms") != 0) {
+                return -1;
+        }
+
+        value *= unit;
+        if (!(value >= 1e3 && value <= TRANSFER_MAX_TARGET_LATENCY)) {
+                return -1;
+        }
+
+        *latency = value;
+
+        return 0;
+}
+
+/**
+ * Parses one of the shared transfer flags into options. Returns 0 if the flag
+ * was handled, -1 if its argument is invalid, or 1 if opt is not a transfer
+ * flag at all.
+ */
+int
+parse_transfer_option (int opt, const char *arg, struct transfer_options *options)
+{
+        off_t size;
+
+        switch (opt) {
+                case TRANSFER_OPTION_QUEUE_DEPTH:
+                        if (parse_count (arg, TRANSFER_MAX_QUEUE_DEPTH,
+                                         &options->queue_depth) == -1) {
+                                error (0, 0, "invalid queue depth: \"%s\"", arg);
+                                return -1;
+                        }
+
+                        return 0;
+                case TRANSFER_OPTION_JOBS:
+                        if (parse_count (arg, TRANSFER_MAX_JOBS,
+                                         &options->jobs) == -1) {
+                                error (0, 0, "invalid number of jobs: \"%s\"", arg);
+                                return -1;
+                        }
+
+                        return 0;
+                case TRANSFER_OPTION_BRICK_JOBS:
+                        if (parse_count (arg, TRANSFER_MAX_JOBS,
+                                         &options->brick_jobs) == -1) {
+                                error (0, 0, "invalid number of jobs per brick: \"%s\"",
+                                       arg);
+                                return -1;
+                        }
+
+                        return 0;
+                case TRANSFER_OPTION_BUFFER_SIZE:
+                        size = strtosize (arg);
+                        if (size < TRANSFER_MIN_BUFFER_SIZE
+                                        || size > TRANSFER_MAX_BUFFER_SIZE) {
+                                error (0, 0, "invalid buffer size: \"%s\"", arg);
+                                return -1;
+                        }
+
+                        options->buffer_size = size;
+                        return 0;
+                case TRANSFER_OPTION_BUFFERS:
+                        if (parse_count (arg, TRANSFER_MAX_BUFFERS,
+                                         &options->buffers) == -1) {
+                                error (0, 0, "invalid number of buffers: \"%s\"", arg);
+                                return -1;
+                        }
+
+                        return 0;
+                case TRANSFER_OPTION_HUGE_PAGES:
+                        options->huge_pages = true;
+                        return 0;
+                case TRANSFER_OPTION_BLOCK_SIZE:
+                        if (strcmp (arg, "auto") == 0) {
+                                options->block_size = 0;
+                                options->auto_block_size = true;
+                                return 0;
+                        }
+
+                        size = strtosize (arg);
+                        if (size < TRANSFER_MIN_BUFFER_SIZE
+                                        || size > TRANSFER_MAX_BUFFER_SIZE) {
+                                error (0, 0, "invalid block size: \"%s\"", arg);
+                                return -1;
+                        }
+
+                        options->block_size = size;
+                        options->auto_block_size = false;
+                        return 0;
+                case TRANSFER_OPTION_STATS:
+                        if (strcmp (arg, "text") == 0) {
+                                options->stats = TRANSFER_STATS_TEXT;
+                        } else if (strcmp (arg, "json") == 0) {
+                                options->stats = TRANSFER_STATS_JSON;
+                        } else {
+                                error (0, 0, "invalid stats format: \"%s\"", arg);
+                                return -1;
+                        }
+
+                        return 0;
+                case TRANSFER_OPTION_STATS_INTERVAL:
+                        if (parse_count (arg, TRANSFER_MAX_STATS_INTERVAL,
+                                         &options->stats_interval) == -1) {
+                                error (0, 0, "invalid stats interval: \"%s\"", arg);
+                                return -1;
+                        }
+
+                        return 0;
+                case TRANSFER_OPTION_VERIFY:
+                        options->verify = true;
+                        return 0;
+                case TRANSFER_OPTION_CHECKSUM_OUT:
+                        options->checksum_file = arg;
+                        return 0;
+                case TRANSFER_OPTION_RESUME:
+                        options->journal = arg;
+                        return 0;
+                case TRANSFER_OPTION_DELTA:
+                        options->delta = true;
+                        return 0;
+                case TRANSFER_OPTION_BWLIMIT:
+                        size = strtosize (arg);
+                        if (size <= 0) {
+                                error (0, 0, "invalid bandwidth limit: \"%s\"", arg);
+                                return -1;
+                        }
+
+                        options->bwlimit = size;
+                        return 0;
+                case TRANSFER_OPTION_IOPS_LIMIT:
+                        if (parse_count (arg, TRANSFER_MAX_IOPS_LIMIT,
+                                         &options->iops_limit) == -1) {
+                                error (0, 0, "invalid IOPS limit: \"%s\"", arg);
+                                return -1;
+                        }
+
+                        return 0;
+                case TRANSFER_OPTION_IO_URING:
+#ifdef HAVE_LIBURING
+                        options->io_uring = true;
+                        return 0;
+#else
+                        error (0, 0, "built without io_uring support");
+                        return -1;
+#endif
+                case TRANSFER_OPTION_MMAP:
+                        options->mmap = true;
+                        return 0;
+                case TRANSFER_OPTION_DIRECT:
+                        options->direct = true;
+                        return 0;
+                case TRANSFER_OPTION_TARGET_LATENCY:
+                        if (parse_latency (arg, &options->target_latency) == -1) {
+                                error (0, 0, "invalid target latency: \"%s\"", arg);
+                                return -1;
+                        }
+
+                        return 0;
+                case TRANSFER_OPTION_CONNECTIONS:
+                        if (parse_count (arg, TRANSFER_MAX_CONNECTIONS,
+                                         &options->connections) == -1) {
+                                error (0, 0, "invalid number of connections: \"%s\"", arg);
+                                return -1;
+                        }
+
+                        return 0;
+                default:
+                        return 1;
+        }
+}
+
+void
+transfer_local (struct transfer_endpoint *endpoint, int fd)
+{
+        endpoint->type = TRANSFER_LOCAL;
+        endpoint->fd = fd;
+        endpoint->glfd = NULL;
+        endpoint->nglfds = 0;
+        endpoint->stripe = 0;
+}
+
+void
+transfer_gluster (struct transfer_endpoint *endpoint, glfs_fd_t *glfd)
+{
+        endpoint->type = TRANSFER_GLUSTER;
+        endpoint->fd = -1;
+        endpoint->glfd = glfd;
+        endpoint->glfds[0] = glfd;
+        endpoint->nglfds = 1;
+        endpoint->stripe = 0;
+}
+
+void
+transfer_discard (struct transfer_endpoint *endpoint)
+{
+        endpoint->type = TRANSFER_DISCARD;
+        endpoint->fd = -1;
+        endpoint->glfd = NULL;
+        endpoint->nglfds = 0;
+        endpoint->stripe = 0;
+}
+
+/**
+ * Opens path on every connection in conns but the first, whose fd the
+ * endpoint already holds, so that asynchronous fops can be spread over all of
+ * them, and takes note of the volume's stripe width. Returns 0 on success, or
+ * -1 with errno set and nothing left open.
+ */
+int
+transfer_open_connections (struct transfer_endpoint *endpoint,
+                           const struct transfer_connections *conns,
+                           const char *path, int flags)
+{
+        glfs_fd_t *glfd;
+        unsigned int i;
+
+        endpoint->stripe = conns->stripe;
+
+        for (i = 1; i < conns->count; i++) {
+                glfd = glfs_open (conns->fs[i], path, flags);
+                if (glfd == NULL) {
+                        transfer_close_connections (endpoint);
+                        return -1;
+                }
+
+                endpoint->glfds[endpoint->nglfds++] = glfd;
+        }
+
+        return 0;
+}
+
+/**
+ * Closes the fds opened by transfer_open_connections (), leaving the
+ * endpoint's own fd alone.
+ */
+void
+transfer_close_connections (struct transfer_endpoint *endpoint)
+{
+        while (endpoint->nglfds > 1) {
+                glfs_close (endpoint->glfds[--endpoint->nglfds]);
+        }
+}
+
+/**
+ * Reads up to count bytes from endpoint, at offset or, if offset is -1, at
+ * the current file position.
+ */
+static ssize_t
+endpoint_read (struct transfer_endpoint *endpoint, char *buf, size_t count,
+               off_t offset)
+{
+        struct timespec start;
+        uint64_t entered = 0;
+        ssize_t ret;
+
+        transfer_limit (count);
+        if (endpoint->type == TRANSFER_GLUSTER) {
+                entered = transfer_limit_enter ();
+        }
+
+        transfer_stats_clock (&start);
+
+        if (endpoint->type == TRANSFER_GLUSTER && offset == -1) {
+                ret = glfs_read (endpoint->glfd, buf, count, 0);
+        } else if (endpoint->type == TRANSFER_GLUSTER) {
+#ifdef HAVE_GLFS_7_6
+                ret = glfs_pread (endpoint->glfd, buf, count, offset, 0, NULL);
+#else
+                ret = glfs_pread (endpoint->glfd, buf, count, offset, 0);
+#endif
+        } else {
+                // A local read may block indefinitely (e.g. on a terminal), so
+                // it is the only place where the writer is allowed to cancel
+                // the reader.
+                pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, NULL);
+                if (offset == -1) {
+                        ret = read (endpoint->fd, buf, count);
+                } else {
+                        ret = pread (endpoint->fd, buf, count, offset);
+                }
+                pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
+        }
+
+        transfer_limit_leave (entered);
+        transfer_stats_fop (TRANSFER_FOP_READ, ret, &start);
+
+        return ret;
+}
+
+/**
+ * Writes all of buf to endpoint, at offset or, if offset is -1, at the
+ * current file position.
+ */
+static int
+endpoint_write (struct transfer_endpoint *endpoint, const char *buf, size_t count,
+                off_t offset)
+{
+        struct timespec start;
+        uint64_t entered = 0;
+        ssize_t ret;
+        size_t num_written;
+
+        if (endpoint->type == TRANSFER_DISCARD) {
+                return 0;
+        }
+
+        for (num_written = 0; num_written < count; num_written += ret) {
+                transfer_limit (0);
+                if (endpoint->type == TRANSFER_GLUSTER) {
+                        entered = transfer_limit_enter ();
+                }
+
+                transfer_stats_clock (&start);
+                if (endpoint->type == TRANSFER_GLUSTER && offset == -1) {
+                        ret = glfs_write (endpoint->glfd,
+                                          &buf[num_written],
+                                          count - num_written, 0);
+                } else if (endpoint->type == TRANSFER_GLUSTER) {
+#ifdef HAVE_GLFS_7_6
+                        ret = glfs_pwrite (endpoint->glfd, &buf[num_written],
+                                           count - num_written,
+                                           offset + num_written, 0, NULL, NULL);
+#else
+                        ret = glfs_pwrite (endpoint->glfd, &buf[num_written],
+                                           count - num_written,
+                                           offset + num_written, 0);
+#endif
+                } else if (offset == -1) {
+                        ret = write (endpoint->fd,
+                                     &buf[num_written],
+                                     count - num_written);
+                } else {
+                        ret = pwrite (endpoint->fd,
+                                      &buf[num_written],
+                                      count - num_written,
+                                      offset + num_written);
+                }
+
+                transfer_limit_leave (entered);
+                transfer_stats_fop (TRANSFER_FOP_WRITE, ret, &start);
+                if (ret == -1) {
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+/**
+ * Writes count bytes of buf to the destination of xfer at offset, unless it
+ * holds the same bytes there already.
+ */
+static int
+write_delta (struct transfer *xfer, const char *buf, size_t count, off_t offset)
+{
+        ssize_t ret = 0;
+        size_t num_read;
+
+        for (num_read = 0; num_read < count; num_read += ret) {
+                ret = endpoint_read (xfer->dst, &xfer->scratch[num_read],
+                                     count - num_read, offset + num_read);
+                if (ret == -1) {
+                        return -1;
+                }
+
+                if (ret == 0) {
+                        break;
+                }
+        }
+
+        if (num_read == count && memcmp (xfer->scratch, buf, count) == 0) {
+                return 0;
+        }
+
+        return endpoint_write (xfer->dst, buf, count, offset);
+}
+
+// Must be called with xfer->lock held.
+static void
+fail (struct transfer *xfer, int err)
+{
+        if (xfer->error == 0) {
+                xfer->error = err ? err : EIO;
+        }
+
+        pthread_cond_broadcast (&xfer->cond);
+}
+
+/**
+ * Takes in the outcome of the asynchronous read of the slot data, ret bytes
+ * or -1 with errno set.
+ */
+static void
+read_complete (ssize_t ret, void *data)
+{
+        struct transfer_slot *slot = data;
+        struct transfer *xfer = slot->xfer;
+        int err = errno;
+
+        transfer_limit_leave (slot->entered);
+        transfer_stats_fop (TRANSFER_FOP_READ, ret, &slot->submitted);
+
+        pthread_mutex_lock (&xfer->lock);
+        xfer->reading--;
+        if (ret < 0) {
+                fail (xfer, err);
+        } else {
+                slot->len = ret;
+                slot->state = SLOT_FULL;
+        }
+
+        pthread_cond_broadcast (&xfer->cond);
+        pthread_mutex_unlock (&xfer->lock);
+}
+
+static void
+write_complete (ssize_t ret, void *data)
+{
+        struct transfer_slot *slot = data;
+        struct transfer *xfer = slot->xfer;
+        int err = errno;
+
+        transfer_limit_leave (slot->entered);
+        transfer_stats_fop (TRANSFER_FOP_WRITE, ret, &slot->submitted);
+
+        pthread_mutex_lock (&xfer->lock);
+        xfer->writing--;
+        if (ret <= 0) {
+                fail (xfer, ret == 0 ? EIO : err);
+        } else {
+                slot->done += ret;
+                if (slot->done < slot->len) {
+                        slot->state = SLOT_RETRY;
+                        xfer->retries++;
+                } else {
+                        slot->state = SLOT_FREE;
+                }
+        }
+
+        pthread_cond_broadcast (&xfer->cond);
+        pthread_mutex_unlock (&xfer->lock);
+}
+
+#ifdef HAVE_GLFS_7_6
+static void
+read_done (glfs_fd_t *fd, ssize_t ret, struct glfs_stat *prestat,
+           struct glfs_stat *poststat, void *data)
+#else
+static void
+read_done (glfs_fd_t *fd, ssize_t ret, void *data)
+#endif
+{
+        read_complete (ret, data);
+}
+
+#ifdef HAVE_GLFS_7_6
+static void
+write_done (glfs_fd_t *fd, ssize_t ret, struct glfs_stat *prestat,
+            struct glfs_stat *poststat, void *data)
+#else
+static void
+write_done (glfs_fd_t *fd, ssize_t ret, void *data)
+#endif
+{
+        write_complete (ret, data);
+}
+
+/**
+ * Picks the fd of endpoint that the asynchronous fops of slot go through.
+ * Neighbouring slots use different connections, so the fops in flight at any
+ * time are spread evenly across all of them.
+ */
+static glfs_fd_t *
+slot_fd (struct transfer *xfer, struct transfer_endpoint *endpoint,
+         struct transfer_slot *slot)
+{
+        return endpoint->glfds[(slot - xfer->slots) % endpoint->nglfds];
+}
+
+/**
+ * Submits a positional read of slot from the source. Must be called with
+ * xfer->lock held; the lock is dropped around the submission because the
+ * completion callback may run before the submission returns. A read of a
+ * local file is only queued on the ring, until flush_ring ().
+ */
+static void
+submit_read (struct transfer *xfer, struct transfer_slot *slot)
+{
+        int ret;
+
+        slot->state = SLOT_READING;
+        xfer->reading++;
+        pthread_mutex_unlock (&xfer->lock);
+
+        transfer_limit (slot->want);
+        if (xfer->src->type == TRANSFER_GLUSTER) {
+                slot->entered = transfer_limit_enter ();
+                transfer_stats_clock (&slot->submitted);
+                ret = glfs_pread_async (slot_fd (xfer, xfer->src, slot),
+                                        slot->buf,
+                                        slot->want,
+                                        slot->offset,
+                                        0, read_done, slot);
+        } else {
+                slot->entered = 0;
+                transfer_stats_clock (&slot->submitted);
+                ret = transfer_uring_read (xfer->uring, xfer->src->fd,
+                                           slot->buf,
+                                           slot->want,
+                                           slot->offset,
+                                           read_complete, slot);
+        }
+
+        pthread_mutex_lock (&xfer->lock);
+        if (ret == -1) {
+                transfer_limit_leave (slot->entered);
+                xfer->reading--;
+                fail (xfer, errno);
+        } else if (xfer->src->type != TRANSFER_GLUSTER) {
+                xfer->unsubmitted++;
+        }
+}
+
+/**
+ * Submits the unwritten remainder of slot, as submit_read () does its read.
+ */
+static void
+submit_write (struct transfer *xfer, struct transfer_slot *slot)
+{
+        int ret;
+
+        slot->state = SLOT_WRITING;
+        xfer->writing++;
+        pthread_mutex_unlock (&xfer->lock);
+
+        transfer_limit (0);
+        if (xfer->dst->type == TRANSFER_GLUSTER) {
+                slot->entered = transfer_limit_enter ();
+                transfer_stats_clock (&slot->submitted);
+                ret = glfs_pwrite_async (slot_fd (xfer, xfer->dst, slot),
+                                         &slot->buf[slot->done],
+                                         slot->len - slot->done,
+                                         slot->dest_offset + slot->done,
+                                         0, write_done, slot);
+        } else {
+                slot->entered = 0;
+                transfer_stats_clock (&slot->submitted);
+                ret = transfer_uring_write (xfer->uring, xfer->dst->fd,
+                                            &slot->buf[slot->done],
+                                            slot->len - slot->done,
+                                            slot->dest_offset + slot->done,
+                                            write_complete, slot);
+        }
+
+        pthread_mutex_lock (&xfer->lock);
+        if (ret == -1) {
+                transfer_limit_leave (slot->entered);
+                xfer->writing--;
+                fail (xfer, errno);
+        } else if (xfer->dst->type != TRANSFER_GLUSTER) {
+                xfer->unsubmitted++;
+        }
+}
+
+/**
+ * Submits the fops queued on the ring, if there are any, and returns whether
+ * there were. Must be called with xfer->lock held, which is dropped around
+ * the submission, so the caller has to look again at whatever it was about
+ * to wait for.
+ */
+static bool
+flush_ring (struct transfer *xfer)
+{
+        int ret;
+
+        if (xfer->unsubmitted == 0) {
+                return false;
+        }
+
+        xfer->unsubmitted = 0;
+        pthread_mutex_unlock (&xfer->lock);
+        ret = transfer_uring_submit (xfer->uring);
+        pthread_mutex_lock (&xfer->lock);
+
+        if (ret == -1) {
+                fail (xfer, errno);
+        }
+
+        return true;
+}
+
+/**
+ * Resubmits the remainder of one short asynchronous write, if there is one
+ * and the queue has room for it. Must be called with xfer->lock held.
+ */
+static bool
+resubmit_short_write (struct transfer *xfer)
+{
+        unsigned int i;
+
+        if (xfer->retries == 0 || xfer->writing >= xfer->queue_depth) {
+                return false;
+        }
+
+        for (i = 0; i < xfer->nslots; i++) {
+                if (xfer->slots[i].state == SLOT_RETRY) {
+                        xfer->retries--;
+                        submit_write (xfer, &xfer->slots[i]);
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+/**
+ * Waits for another thread to move the transfer along, counting the time as
+ * spent waiting for the given side of it. Must be called with xfer->lock
+ * held. The fops queued on the ring are submitted instead, if there are any,
+ * so that a stage submits all of them at once when it runs out of work.
+ */
+static void
+wait_for (struct transfer *xfer, enum transfer_stall side)
+{
+        struct timespec start;
+
+        if (flush_ring (xfer)) {
+                return;
+        }
+
+        transfer_stats_clock (&start);
+        pthread_cond_wait (&xfer->cond, &xfer->lock);
+        transfer_stats_stall (side, &start);
+}
+
+/**
+ * Returns the number of bytes to read into the next block, which the reader
+ * must have locked.
+ */
+static size_t
+next_block (struct transfer *xfer)
+{
+        size_t want = xfer->block_size;
+
+        if (xfer->head > 0 && xfer->head < want) {
+                want = xfer->head;
+        }
+
+        xfer->head = 0;
+
+        return want;
+}
+
+/**
+ * Reads from the current position of a streamed source until count bytes
+ * are in buf, or the source ends. Returns the number of bytes read, or -1
+ * with errno set.
+ */
+static ssize_t
+gather (struct transfer_endpoint *endpoint, char *buf, size_t count)
+{
+        size_t done = 0;
+        ssize_t ret;
+
+        while (done < count) {
+                ret = endpoint_read (endpoint, buf + done, count - done, -1);
+                if (ret == -1) {
+                        return -1;
+                } else if (ret == 0) {
+                        break;
+                }
+
+                done += ret;
+        }
+
+        return done;
+}
+
+/**
+ * Unmaps the whole pages of the mapping of xfer that come before offset of the
+ * source, once there are at least MAP_WINDOW bytes of them. Slots are reused
+ * in the order they were handed out, so everything before the last block of a
+ * slot that is free again is done with.
+ */
+static void
+release_map (struct transfer *xfer, off_t offset)
+{
+        struct transfer_map *map = &xfer->map;
+        off_t end = (offset + map->shift) & ~((off_t) map->page_size - 1);
+
+        if (end - map->released < MAP_WINDOW) {
+                return;
+        }
+
+        munmap (map->base + (map->released - map->start), end - map->released);
+        map->released = end;
+}
+
+/**
+ * Sets up cache to keep the local file of endpoint, which the transfer starts
+ * at offset start of, out of the page cache, if that was asked for. O_DIRECT
+ * is only set if every block will be aligned, from an aligned offset on, and
+ * the file system takes it. Otherwise, the pages of the file are dropped as
+ * the transfer goes.
+ */
+static void
+start_cache (struct transfer *xfer, struct transfer_endpoint *endpoint,
+             struct transfer_cache *cache, off_t start, bool dirty)
+{
+        if (cache->flags == -1) {
+                return;
+        } else if (start == -1) {
+                cache->flags = -1;
+                return;
+        }
+
+        cache->dirty = dirty;
+        cache->start = start;
+        cache->flushed = start;
+        cache->dropped = start;
+
+        if (start % DIRECT_ALIGN == 0 && xfer->block_size % DIRECT_ALIGN == 0
+                        && xfer->head % DIRECT_ALIGN == 0
+                        && fcntl (endpoint->fd, F_SETFL, cache->flags | O_DIRECT) == 0) {
+                cache->direct = true;
+        } else {
+                cache->drop = true;
+        }
+}
+
+/**
+ * Clears O_DIRECT on the fd of cache for a block that isn't aligned, which
+ * can only be the last one, and has its pages dropped instead.
+ */
+static void
+leave_direct (struct transfer_endpoint *endpoint, struct transfer_cache *cache)
+{
+        fcntl (endpoint->fd, F_SETFL, cache->flags);
+        cache->direct = false;
+        cache->drop = true;
+}
+
+/**
+ * Drops the pages of the file of cache that the transfer is done with, up to
+ * offset end, once they make up a window. Those of a file written are written
+ * back first; writeback is started on each window as soon as it is done, and
+ * waited for a window later, so that the writer seldom has to wait for the
+ * disk.
+ */
+static void
+drop_cache (struct transfer_endpoint *endpoint, struct transfer_cache *cache,
+            off_t end)
+{
+        off_t upto = end;
+
+        if (cache->dirty) {
+                if (end - cache->flushed >= DROP_WINDOW) {
+                        sync_file_range (endpoint->fd, cache->flushed,
+                                         end - cache->flushed, SYNC_FILE_RANGE_WRITE);
+                        cache->flushed = end;
+                }
+
+                upto = cache->flushed - DROP_WINDOW;
+        }
+
+        if (upto - cache->dropped < DROP_WINDOW) {
+                return;
+        }
+
+        if (cache->dirty) {
+                sync_file_range (endpoint->fd, cache->dropped, upto - cache->dropped,
+                                 SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                                 | SYNC_FILE_RANGE_WAIT_AFTER);
+        }
+
+        posix_fadvise (endpoint->fd, cache->dropped, upto - cache->dropped,
+                       POSIX_FADV_DONTNEED);
+        cache->dropped = upto;
+}
+
+/**
+ * Drops whatever pages of the file of cache are left, once the transfer is
+ * over, and gives its fd back the flags it came with.
+ */
+static void
+finish_cache (struct transfer_endpoint *endpoint, struct transfer_cache *cache)
+{
+        if (!cache->direct && !cache->drop) {
+                return;
+        }
+
+        if (cache->dirty) {
+                sync_file_range (endpoint->fd, cache->dropped, 0,
+                                 SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                                 | SYNC_FILE_RANGE_WAIT_AFTER);
+        }
+
+        posix_fadvise (endpoint->fd, cache->dropped, 0, POSIX_FADV_DONTNEED);
+
+        if (cache->direct) {
+                fcntl (endpoint->fd, F_SETFL, cache->flags);
+        }
+}
+
+/**
+ * Returns the offset of the destination below which every write handed out
+ * so far has completed. The writer must have xfer locked.
+ */
+static off_t
+written (struct transfer *xfer)
+{
+        off_t end = xfer->dst_cache.start + xfer->total;
+        struct transfer_slot *slot;
+        unsigned int i;
+
+        for (i = 0; xfer->async_write && i < xfer->nslots; i++) {
+                slot = &xfer->slots[i];
+                if ((slot->state == SLOT_WRITING || slot->state == SLOT_RETRY)
+                                && slot->dest_offset < end) {
+                        end = slot->dest_offset;
+                }
+        }
+
+        return end;
+}
+
+static void *
+reader (void *data)
+{
+        struct transfer *xfer = data;
+        struct transfer_slot *slot;
+        ssize_t num_read;
+        size_t want;
+
+        pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
+
+        pthread_mutex_lock (&xfer->lock);
+        while (!xfer->eof && xfer->error == 0) {
+                slot = &xfer->slots[xfer->issued % xfer->nslots];
+                if (slot->state != SLOT_FREE) {
+                        wait_for (xfer, TRANSFER_STALL_DEST);
+                        continue;
+                }
+
+                if (xfer->async_read && xfer->reading >= xfer->queue_depth) {
+                        wait_for (xfer, TRANSFER_STALL_SOURCE);
+                        continue;
+                }
+
+                if (!xfer->positional_read) {
+                        want = next_block (xfer);
+                        pthread_mutex_unlock (&xfer->lock);
+                        if (xfer->gather) {
+                                num_read = gather (xfer->src, slot->buf, want);
+                        } else {
+                                num_read = endpoint_read (xfer->src, slot->buf, want, -1);
+                        }
+                        pthread_mutex_lock (&xfer->lock);
+
+                        if (num_read == -1) {
+                                fail (xfer, errno);
+                        } else if (num_read == 0) {
+                                xfer->eof = true;
+                        } else {
+                                slot->len = num_read;
+                                slot->state = SLOT_FULL;
+                                xfer->issued++;
+                        }
+
+                        pthread_cond_broadcast (&xfer->cond);
+                        continue;
+                }
+
+                if (xfer->read_offset >= xfer->read_end) {
+                        xfer->eof = true;
+                        break;
+                }
+
+                if (xfer->map.base && slot->want > 0) {
+                        release_map (xfer, slot->offset + slot->want);
+                }
+
+                slot->offset = xfer->read_offset;
+                slot->want = xfer->read_end - xfer->read_offset;
+                want = next_block (xfer);
+                if (slot->want > want) {
+                        slot->want = want;
+                }
+
+                if (xfer->src_cache.direct && slot->want % DIRECT_ALIGN != 0) {
+                        leave_direct (xfer->src, &xfer->src_cache);
+                }
+
+                xfer->read_offset += slot->want;
+                xfer->issued++;
+
+                if (xfer->map.base) {
+                        slot->buf = xfer->map.base + (slot->offset + xfer->map.shift
+                                                      - xfer->map.start);
+                }
+
+                // A mapped source is there to be written already, once the
+                // bandwidth limit lets it through as if it had been read.
+                if (xfer->map_read) {
+                        slot->state = SLOT_READING;
+                        pthread_mutex_unlock (&xfer->lock);
+                        transfer_limit (slot->want);
+                        pthread_mutex_lock (&xfer->lock);
+
+                        slot->len = slot->want;
+                        slot->state = SLOT_FULL;
+                        pthread_cond_broadcast (&xfer->cond);
+                        continue;
+                }
+
+                if (xfer->async_read) {
+                        submit_read (xfer, slot);
+                        continue;
+                }
+
+                // The slot is already accounted for, so a short read is left
+                // for the writer to notice, as with asynchronous reads.
+                slot->state = SLOT_READING;
+                pthread_mutex_unlock (&xfer->lock);
+                num_read = endpoint_read (xfer->src, slot->buf, slot->want,
+                                          slot->offset);
+                pthread_mutex_lock (&xfer->lock);
+
+                if (num_read == -1) {
+                        fail (xfer, errno);
+                } else {
+                        slot->len = num_read;
+                        slot->state = SLOT_FULL;
+                }
+
+                pthread_cond_broadcast (&xfer->cond);
+        }
+
+        // The kernel ties the reads on the ring to the thread that submitted
+        // them, and fails those it has yet to finish once the thread is gone,
+        // so the reader stays until its last read is in.
+        while (xfer->reading > 0) {
+                if (flush_ring (xfer)) {
+                        continue;
+                }
+
+                pthread_cond_wait (&xfer->cond, &xfer->lock);
+        }
+
+        pthread_cond_broadcast (&xfer->cond);
+        pthread_mutex_unlock (&xfer->lock);
+
+        return NULL;
+}
+
+static double
+elapsed (const struct timespec *start, const struct timespec *end)
+{
+        return (end->tv_sec - start->tv_sec)
+                + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Measures the throughput of the current block size once it has moved enough
+ * data, and moves on to the next block size to try. Must be called with
+ * xfer->lock held.
+ */
+static void
+autotune (struct transfer *xfer)
+{
+        struct autotune *tune = &xfer->tune;
+        struct timespec now;
+        double rate;
+        size_t next;
+
+        if (!tune->enabled
+                        || xfer->total - tune->start_total
+                                < (off_t) (TUNE_WINDOW_BLOCKS * xfer->block_size)) {
+                return;
+        }
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        if (elapsed (&tune->start, &now) < TUNE_WINDOW_SECS) {
+                return;
+        }
+
+        rate = (xfer->total - tune->start_total) / elapsed (&tune->start, &now);
+
+        // Going back the other way first returns to the better block size,
+        // then explores past it.
+        if (tune->rate > 0 && rate < tune->rate * TUNE_MIN_GAIN) {
+                tune->direction = -tune->direction;
+                tune->reversals++;
+        }
+
+        next = tune->direction > 0 ? xfer->block_size * 2 : xfer->block_size / 2;
+        if (next < tune->min || next > tune->max) {
+                tune->enabled = false;
+                return;
+        }
+
+        xfer->block_size = next;
+        tune->rate = rate;
+        tune->start = now;
+        tune->start_total = xfer->total;
+        if (tune->reversals == 2) {
+                tune->enabled = false;
+        }
+}
+
+static void
+writer (struct transfer *xfer)
+{
+        struct transfer_slot *slot;
+        size_t len;
+        off_t offset;
+        off_t src_end;
+        off_t dst_end;
+        bool src_drop;
+        bool dst_drop;
+        int ret;
+
+        pthread_mutex_lock (&xfer->lock);
+        while (xfer->error == 0) {
+                if (resubmit_short_write (xfer)) {
+                        continue;
+                }
+
+                if (xfer->consumed == xfer->issued) {
+                        if (xfer->eof) {
+                                break;
+                        }
+
+                        wait_for (xfer, TRANSFER_STALL_SOURCE);
+                        continue;
+                }
+
+                slot = &xfer->slots[xfer->consumed % xfer->nslots];
+                if (slot->state != SLOT_FULL) {
+                        wait_for (xfer, TRANSFER_STALL_SOURCE);
+                        continue;
+                }
+
+                if (xfer->async_write && xfer->writing >= xfer->queue_depth) {
+                        wait_for (xfer, TRANSFER_STALL_DEST);
+                        continue;
+                }
+
+                xfer->consumed++;
+
+                // Anything read past a short positional read belongs to a file
+                // that shrank underneath us, so it is dropped, just as a
+                // streaming read would have stopped at the new end of file.
+                if (xfer->truncated) {
+                        slot->state = SLOT_FREE;
+                        pthread_cond_broadcast (&xfer->cond);
+                        continue;
+                }
+
+                if (xfer->positional_read && slot->len < slot->want) {
+                        xfer->truncated = true;
+                        xfer->eof = true;
+                }
+
+                len = slot->len;
+                if (xfer->checksum) {
+                        // The slot stays ours until it is written, so the
+                        // reader can carry on meanwhile.
+                        pthread_mutex_unlock (&xfer->lock);
+                        *xfer->checksum = crc32c (*xfer->checksum, slot->buf, len);
+                        pthread_mutex_lock (&xfer->lock);
+                }
+
+                if (xfer->dst_cache.direct && len % DIRECT_ALIGN != 0) {
+                        leave_direct (xfer->dst, &xfer->dst_cache);
+                }
+
+                if (xfer->async_write) {
+                        slot->done = 0;
+                        slot->dest_offset = xfer->write_offset;
+                        xfer->write_offset += len;
+                        submit_write (xfer, slot);
+                } else {
+                        offset = -1;
+                        if (xfer->positional_write) {
+                                offset = xfer->write_offset;
+                                xfer->write_offset += len;
+                        }
+
+                        pthread_mutex_unlock (&xfer->lock);
+                        if (xfer->map_write) {
+                                // The block was read straight into place.
+                                ret = 0;
+                        } else if (xfer->delta) {
+                                ret = write_delta (xfer, slot->buf, len, offset);
+                        } else {
+                                ret = endpoint_write (xfer->dst, slot->buf, len, offset);
+                        }
+                        pthread_mutex_lock (&xfer->lock);
+
+                        if (ret == -1) {
+                                fail (xfer, errno);
+                                break;
+                        }
+
+                        slot->state = SLOT_FREE;
+                        pthread_cond_broadcast (&xfer->cond);
+                }
+
+                xfer->total += len;
+                autotune (xfer);
+
+                // The reader can turn the source over to having its pages
+                // dropped, so whether they are is only looked at locked.
+                src_drop = xfer->src_cache.drop;
+                dst_drop = xfer->dst_cache.drop;
+                if (src_drop || dst_drop) {
+                        src_end = xfer->src_cache.start + xfer->total;
+                        dst_end = written (xfer);
+                        pthread_mutex_unlock (&xfer->lock);
+                        if (src_drop) {
+                                drop_cache (xfer->src, &xfer->src_cache, src_end);
+                        }
+
+                        if (dst_drop) {
+                                drop_cache (xfer->dst, &xfer->dst_cache, dst_end);
+                        }
+
+                        pthread_mutex_lock (&xfer->lock);
+                }
+        }
+
+        // Buffers must outlive every fop that still references them.
+        while (xfer->reading > 0 || xfer->writing > 0
+                        || (xfer->retries > 0 && xfer->error == 0)) {
+                if (resubmit_short_write (xfer) || flush_ring (xfer)) {
+                        continue;
+                }
+
+                pthread_cond_wait (&xfer->cond, &xfer->lock);
+        }
+
+        pthread_mutex_unlock (&xfer->lock);
+}
+
+/**
+ * Sets up the ring for the local side of xfer once its buffers are there. If
+ * the kernel offers no io_uring, the local side does with blocking positional
+ * fops instead.
+ */
+static void
+start_ring (struct transfer *xfer)
+{
+        bool local_read = xfer->async_read && xfer->src->type == TRANSFER_LOCAL;
+        bool local_write = xfer->async_write && xfer->dst->type == TRANSFER_LOCAL;
+        char **bufs;
+        unsigned int i;
+
+        if (!local_read && !local_write) {
+                return;
+        }
+
+        bufs = calloc (xfer->nslots, sizeof (*bufs));
+        if (bufs) {
+                for (i = 0; i < xfer->nslots; i++) {
+                        bufs[i] = xfer->slots[i].buf;
+                }
+
+                xfer->uring = transfer_uring_create (xfer->queue_depth, bufs,
+                                                     xfer->nslots,
+                                                     xfer->buffer_size);
+                free (bufs);
+        }
+
+        if (xfer->uring == NULL && local_read) {
+                xfer->async_read = false;
+        }
+
+        if (xfer->uring == NULL && local_write) {
+                xfer->async_write = false;
+        }
+}
+
+static int
+file_size (struct transfer_endpoint *endpoint, off_t *size)
+{
+        struct stat statbuf;
+        int ret;
+
+        if (endpoint->type == TRANSFER_GLUSTER) {
+                ret = glfs_fstat (endpoint->glfd, &statbuf);
+        } else {
+                ret = fstat (endpoint->fd, &statbuf);
+        }
+
+        if (ret == 0) {
+                *size = statbuf.st_size;
+        }
+
+        return ret;
+}
+
+static off_t
+endpoint_seek (struct transfer_endpoint *endpoint, off_t offset, int whence)
+{
+        if (endpoint->type == TRANSFER_GLUSTER) {
+                return glfs_lseek (endpoint->glfd, offset, whence);
+        }
+
+        return lseek (endpoint->fd, offset, whence);
+}
+
+/**
+ * Maps the local file of xfer into memory if it is to be read or written in
+ * place, for the byte range of the transfer. A destination is extended to the
+ * end of the range first, with its blocks allocated up front, so that running
+ * out of space fails the transfer here rather than raise SIGBUS halfway
+ * through it. A file that can't be mapped is read or written through the
+ * buffers as usual. Returns 0, or -1 with errno set if the destination can't
+ * be extended.
+ */
+static int
+start_map (struct transfer *xfer)
+{
+        struct transfer_map *map = &xfer->map;
+        struct transfer_endpoint *endpoint = xfer->map_read ? xfer->src : xfer->dst;
+        int prot = PROT_READ;
+        void *base = MAP_FAILED;
+
+        if (!xfer->map_read && !xfer->map_write) {
+                return 0;
+        }
+
+        if (xfer->map_write) {
+                if (file_size (endpoint, &map->size) == -1) {
+                        return -1;
+                }
+
+                map->shift = xfer->write_offset - xfer->read_offset;
+                prot |= PROT_WRITE;
+        }
+
+        map->page_size = sysconf (_SC_PAGESIZE);
+        map->start = (xfer->read_offset + map->shift) & ~((off_t) map->page_size - 1);
+        map->end = xfer->read_end + map->shift;
+        map->released = map->start;
+
+        if (map->end > map->start) {
+                base = mmap (NULL, map->end - map->start, prot, MAP_SHARED,
+                             endpoint->fd, map->start);
+        }
+
+        if (base == MAP_FAILED) {
+                xfer->map_read = false;
+                xfer->map_write = false;
+                return 0;
+        }
+
+        map->base = base;
+        madvise (map->base, map->end - map->start, MADV_SEQUENTIAL);
+
+        if (xfer->map_write && map->size < map->end
+                        && (transfer_preallocate (endpoint, map->size,
+                                                  map->end - map->size) == -1
+                            || ftruncate (endpoint->fd, map->end) == -1)) {
+                return -1;
+        }
+
+        return 0;
+}
+
+/**
+ * Unmaps what is left of the mapping of xfer. A destination that was extended
+ * beyond what the source turned out to hold is cut back to what was written.
+ * Returns 0, or -1 with errno set.
+ */
+static int
+finish_map (struct transfer *xfer)
+{
+        struct transfer_map *map = &xfer->map;
+        off_t size;
+
+        if (map->base == NULL) {
+                return 0;
+        }
+
+        munmap (map->base + (map->released - map->start), map->end - map->released);
+        map->base = NULL;
+
+        if (!xfer->map_write || xfer->write_offset >= map->end
+                        || map->size >= map->end) {
+                return 0;
+        }
+
+        size = xfer->write_offset > map->size ? xfer->write_offset : map->size;
+
+        return ftruncate (xfer->dst->fd, size);
+}
+
+/**
+ * Runs the reader and the writer over a prepared transfer until the source is
+ * exhausted or either side fails.
+ */
+static int
+run (struct transfer *xfer)
+{
+        pthread_t reader_thread;
+        size_t stripe = xfer->dst->stripe;
+        off_t start;
+        int ret = -1;
+        unsigned int i;
+
+        if (xfer->async_read || xfer->map_read || xfer->map_write) {
+                xfer->positional_read = true;
+        }
+
+        if (xfer->async_write || xfer->map_write) {
+                xfer->positional_write = true;
+        }
+
+        // A destination part way through a stripe gets a short block first,
+        // so that the rest start on stripe boundaries.
+        if (stripe > 0) {
+                start = xfer->positional_write ? xfer->write_offset
+                                               : endpoint_seek (xfer->dst, 0, SEEK_CUR);
+                if (start > 0) {
+                        xfer->head = (stripe - start % stripe) % stripe;
+                }
+
+                xfer->gather = !xfer->positional_read;
+        }
+
+        xfer->slots = calloc (xfer->nslots, sizeof (*xfer->slots));
+        if (xfer->slots == NULL) {
+                return -1;
+        }
+
+        if (start_map (xfer) == -1) {
+                goto out;
+        }
+
+        // The slots of a mapped file point into the mapping instead.
+        for (i = 0; i < xfer->nslots; i++) {
+                xfer->slots[i].xfer = xfer;
+                xfer->slots[i].state = SLOT_FREE;
+                if (xfer->map.base) {
+                        continue;
+                }
+
+                xfer->slots[i].buf = buffer_pool_get (xfer->buffer_size,
+                                                      xfer->huge_pages);
+                if (xfer->slots[i].buf == NULL) {
+                        goto out;
+                }
+        }
+
+        if (xfer->delta) {
+                xfer->scratch = buffer_pool_get (xfer->buffer_size, xfer->huge_pages);
+                if (xfer->scratch == NULL) {
+                        goto out;
+                }
+        }
+
+        start_cache (xfer, xfer->src, &xfer->src_cache, xfer->positional_read
+                     ? xfer->read_offset : endpoint_seek (xfer->src, 0, SEEK_CUR),
+                     false);
+        start_cache (xfer, xfer->dst, &xfer->dst_cache, xfer->positional_write
+                     ? xfer->write_offset : endpoint_seek (xfer->dst, 0, SEEK_CUR),
+                     true);
+
+        start_ring (xfer);
+
+        pthread_mutex_init (&xfer->lock, NULL);
+        pthread_cond_init (&xfer->cond, NULL);
+
+        ret = pthread_create (&reader_thread, NULL, reader, xfer);
+        if (ret != 0) {
+                errno = ret;
+                ret = -1;
+                goto destroy;
+        }
+
+        writer (xfer);
+
+        // If the writer gave up, don't wait for a local reader that may be
+        // blocked on input that will never come.
+        if (xfer->error != 0 && xfer->src->type == TRANSFER_LOCAL) {
+                pthread_cancel (reader_thread);
+        }
+
+        pthread_join (reader_thread, NULL);
+
+        ret = 0;
+        if (xfer->error != 0) {
+                errno = xfer->error;
+                ret = -1;
+        }
+
+destroy:
+        pthread_cond_destroy (&xfer->cond);
+        pthread_mutex_destroy (&xfer->lock);
+out:
+        transfer_uring_destroy (xfer->uring);
+        if (finish_map (xfer) == -1) {
+                ret = -1;
+        }
+
+        finish_cache (xfer->src, &xfer->src_cache);
+        finish_cache (xfer->dst, &xfer->dst_cache);
+
+        for (i = 0; i < xfer->nslots && !xfer->map_read && !xfer->map_write; i++) {
+                buffer_pool_put (xfer->slots[i].buf, xfer->buffer_size,
+                                 xfer->huge_pages);
+        }
+
+        buffer_pool_put (xfer->scratch, xfer->buffer_size, xfer->huge_pages);
+        free (xfer->slots);
+
+        return ret;
+}
+
+/**
+ * Returns the size of the transfer buffers for options: large enough for the
+ * block size, or for the largest block size tried by an automatic one.
+ */
+static size_t
+buffer_size (const struct transfer_options *options)
+{
+        if (options->buffer_size != 0 && options->buffer_size >= options->block_size) {
+                return options->buffer_size;
+        } else if (options->block_size != 0) {
+                return options->block_size;
+        } else if (options->auto_block_size) {
+                return TRANSFER_AUTO_MAX_BLOCK;
+        }
+
+        return BUFSIZE;
+}
+
+static size_t
+gcd (size_t a, size_t b)
+{
+        size_t tmp;
+
+        while (b != 0) {
+                tmp = a % b;
+                a = b;
+                b = tmp;
+        }
+
+        return a;
+}
+
+/**
+ * Returns the smallest size that is a whole number of both a and b, either of
+ * which may be 0 for no constraint.
+ */
+static size_t
+lcm (size_t a, size_t b)
+{
+        if (a == 0 || b == 0) {
+                return a + b;
+        }
+
+        return a / gcd (a, b) * b;
+}
+
+/**
+ * Returns the size that the I/O on endpoint should be a multiple of: its
+ * volume's stripe width, and the block size that the storage reports for the
+ * file.
+ */
+static size_t
+io_unit (struct transfer_endpoint *endpoint)
+{
+        struct stat statbuf;
+        int ret;
+
+        if (endpoint->type == TRANSFER_DISCARD) {
+                return 0;
+        } else if (endpoint->type == TRANSFER_GLUSTER) {
+                ret = glfs_fstat (endpoint->glfd, &statbuf);
+        } else {
+                ret = fstat (endpoint->fd, &statbuf);
+        }
+
+        if (ret == -1 || statbuf.st_blksize <= 0) {
+                return endpoint->stripe;
+        }
+
+        return lcm (endpoint->stripe, statbuf.st_blksize);
+}
+
+/**
+ * Sets up an automatic block size for xfer. It starts at the smallest size
+ * that suits the layout of both files, scaled up to TRANSFER_AUTO_MIN_BLOCK,
+ * and tries up to what the buffers hold. Must be called before the buffers
+ * are allocated, as the buffers are enlarged if they can't hold a single
+ * block of that size.
+ */
+static void
+autotune_init (struct transfer *xfer)
+{
+        struct autotune *tune = &xfer->tune;
+        size_t unit;
+
+        unit = lcm (io_unit (xfer->src), io_unit (xfer->dst));
+        if (unit == 0 || unit > TRANSFER_AUTO_MAX_BLOCK) {
+                // Unaligned writes hurt more than unaligned reads.
+                unit = io_unit (xfer->dst);
+        }
+
+        if (unit == 0 || unit > TRANSFER_AUTO_MAX_BLOCK) {
+                unit = TRANSFER_MIN_BUFFER_SIZE;
+        }
+
+        if (xfer->buffer_size < unit) {
+                xfer->buffer_size = unit;
+        }
+
+        tune->min = unit;
+        while (tune->min < TRANSFER_AUTO_MIN_BLOCK
+                        && tune->min * 2 <= xfer->buffer_size) {
+                tune->min *= 2;
+        }
+
+        tune->max = tune->min;
+        while (tune->max * 2 <= xfer->buffer_size) {
+                tune->max *= 2;
+        }
+
+        tune->enabled = tune->max > tune->min;
+        tune->direction = 1;
+        clock_gettime (CLOCK_MONOTONIC, &tune->start);
+        xfer->block_size = tune->min;
+}
+
+/**
+ * Whether endpoint is a local regular file, which can be read and written at
+ * any offset. Writes to a file opened for appending land at its end whatever
+ * the offset, in the order they complete.
+ */
+static bool
+is_local_file (struct transfer_endpoint *endpoint)
+{
+        struct stat statbuf;
+        int flags;
+
+        if (endpoint->type != TRANSFER_LOCAL
+                        || fstat (endpoint->fd, &statbuf) == -1
+                        || !S_ISREG (statbuf.st_mode)) {
+                return false;
+        }
+
+        flags = fcntl (endpoint->fd, F_GETFL);
+
+        return flags != -1 && !(flags & O_APPEND);
+}
+
+/**
+ * Applies options, or the defaults if NULL, to a transfer between src and
+ * dst. The queue depth is at least one fop per connection, or the extra
+ * connections would sit idle.
+ */
+static void
+configure (struct transfer *xfer, const struct transfer_options *options)
+{
+        struct transfer_options defaults;
+
+        if (options == NULL) {
+                transfer_options_init (&defaults);
+                options = &defaults;
+        }
+
+        xfer->queue_depth = options->queue_depth;
+        if (xfer->queue_depth < xfer->src->nglfds) {
+                xfer->queue_depth = xfer->src->nglfds;
+        }
+
+        if (xfer->queue_depth < xfer->dst->nglfds) {
+                xfer->queue_depth = xfer->dst->nglfds;
+        }
+
+        if (xfer->queue_depth > 1) {
+                xfer->async_read = xfer->src->type == TRANSFER_GLUSTER;
+                xfer->async_write = xfer->dst->type == TRANSFER_GLUSTER;
+        }
+
+        // A regular local file across from a Gluster one can be mapped, for
+        // the Gluster fops to use in place of buffers. A delta transfer has
+        // to see each block before it lands in the destination, and one kept
+        // out of the page cache can't be mapped from it.
+        xfer->map_read = options->mmap && !options->direct
+                && xfer->dst->type == TRANSFER_GLUSTER && is_local_file (xfer->src);
+        xfer->map_write = options->mmap && !options->delta && !options->direct
+                && xfer->src->type == TRANSFER_GLUSTER && is_local_file (xfer->dst);
+
+        xfer->src_cache.flags = -1;
+        if (options->direct && is_local_file (xfer->src)) {
+                xfer->src_cache.flags = fcntl (xfer->src->fd, F_GETFL);
+        }
+
+        xfer->dst_cache.flags = -1;
+        if (options->direct && is_local_file (xfer->dst)) {
+                xfer->dst_cache.flags = fcntl (xfer->dst->fd, F_GETFL);
+        }
+
+        // A regular local file goes through the ring at the same queue depth
+        // as a Gluster file goes through the asynchronous fops.
+        xfer->io_uring = options->io_uring;
+        if (xfer->io_uring && !xfer->map_read && is_local_file (xfer->src)) {
+                xfer->async_read = true;
+        }
+
+        if (xfer->io_uring && !xfer->map_write && is_local_file (xfer->dst)) {
+                xfer->async_write = true;
+        }
+
+        // Only blocks whose place in the destination is known can be
+        // compared, and the writer has to see them before they're written.
+        xfer->delta = options->delta && xfer->positional_write;
+        if (xfer->delta) {
+                xfer->async_write = false;
+        }
+
+        xfer->buffer_size = buffer_size (options);
+        xfer->huge_pages = options->huge_pages;
+        xfer->checksum = options->checksum;
+        xfer->block_size = options->block_size;
+        if (options->auto_block_size) {
+                autotune_init (xfer);
+        } else if (xfer->block_size == 0) {
+                xfer->block_size = xfer->buffer_size;
+                if (xfer->dst->stripe > 0 && xfer->block_size > xfer->dst->stripe) {
+                        xfer->block_size -= xfer->block_size % xfer->dst->stripe;
+                }
+        }
+
+        // Every in-flight read and write needs a buffer of its own, unless
+        // told otherwise.
+        xfer->nslots = options->buffers;
+        if (xfer->nslots == 0) {
+                xfer->nslots = 2 * xfer->queue_depth;
+        }
+
+        if (xfer->nslots < TRANSFER_SLOTS) {
+                xfer->nslots = TRANSFER_SLOTS;
+        }
+}
+
+/**
+ * Copies everything from the current position of src up to its end into dst
+ * at dst's current position, leaving both positions after the copied data.
+ * options may be NULL for the defaults. Returns 0 on success, or -1 with errno
+ * set to the first error encountered on either side.
+ */
+int
+transfer (struct transfer_endpoint *src, struct transfer_endpoint *dst,
+          const struct transfer_options *options)
+{
+        struct transfer xfer = {
+                .src = src,
+                .dst = dst,
+        };
+        off_t read_start = 0;
+        int ret;
+
+        configure (&xfer, options);
+
+        if (xfer.async_read || xfer.map_read || xfer.map_write) {
+                read_start = endpoint_seek (src, 0, SEEK_CUR);
+                if (read_start == -1 || file_size (src, &xfer.read_end) == -1) {
+                        return -1;
+                }
+
+                xfer.read_offset = read_start;
+                xfer.positional_read = true;
+        }
+
+        if (xfer.async_write || xfer.map_write) {
+                xfer.write_offset = endpoint_seek (dst, 0, SEEK_CUR);
+                if (xfer.write_offset == -1) {
+                        return -1;
+                }
+
+                xfer.positional_write = true;
+        }
+
+        ret = run (&xfer);
+        if (ret == -1) {
+                return -1;
+        }
+
+        // Positional fops leave the file positions untouched, so move them to
+        // where blocking calls would have left them.
+        if (xfer.positional_read
+                        && endpoint_seek (src, read_start + xfer.total, SEEK_SET) == -1) {
+                ret = -1;
+        }
+
+        if (xfer.positional_write
+                        && endpoint_seek (dst, xfer.write_offset, SEEK_SET) == -1) {
+                ret = -1;
+        }
+
+        return ret;
+}
+
+/**
+ * Copies length bytes starting at offset in src to the same offset in dst,
+ * using offset-addressed I/O only; file positions are left untouched. A
+ * source that ends early is not an error, the copy simply stops there.
+ * Returns the number of bytes copied, or -1 with errno set.
+ */
+off_t
+transfer_range (struct transfer_endpoint *src, struct transfer_endpoint *dst,
+                off_t offset, off_t length,
+                const struct transfer_options *options)
+{
+        struct transfer xfer = {
+                .src = src,
+                .dst = dst,
+                .positional_read = true,
+                .positional_write = true,
+                .read_offset = offset,
+                .read_end = offset + length,
+                .write_offset = offset,
+        };
+
+        configure (&xfer, options);
+
+        if (run (&xfer) == -1) {
+                return -1;
+        }
+
+        return xfer.total;
+}
+
+/**
+ * Opens a file of its own for one worker of a parallel transfer. Workers take
+ * turns over the connections to the file's volume.
+ */
+static int
+open_file (const struct transfer_file *file, unsigned int worker, int flags,
+           struct transfer_endpoint *endpoint)
+{
+        int fd;
+        glfs_fd_t *glfd;
+
+        if (file->type == TRANSFER_GLUSTER) {
+                glfd = glfs_open (file->conns->fs[worker % file->conns->count],
+                                  file->path, flags);
+                if (glfd == NULL) {
+                        return -1;
+                }
+
+                transfer_gluster (endpoint, glfd);
+                endpoint->stripe = file->conns->stripe;
+        } else {
+                fd = open (file->path, flags);
+                if (fd == -1) {
+                        return -1;
+                }
+
+                transfer_local (endpoint, fd);
+        }
+
+        return 0;
+}
+
+static int
+close_file (struct transfer_endpoint *endpoint)
+{
+        if (endpoint->type == TRANSFER_GLUSTER) {
+                return glfs_close (endpoint->glfd);
+        }
+
+        return close (endpoint->fd);
+}
+
+/**
+ * Whether fewer blocks are allocated to a file than its size needs, i.e. it
+ * has holes worth preserving.
+ */
+bool
+transfer_is_sparse (const struct stat *statbuf)
+{
+        return (off_t) statbuf->st_blocks * 512 < statbuf->st_size;
+}
+
+/**
+ * Asks the storage to allocate length bytes at offset of the destination up
+ * front, without changing its size, so that the blocks of a large sequential
+ * file end up contiguous on the bricks and the writes don't each have to
+ * allocate. This is only a hint: running out of space is reported, anything
+ * else just means the storage can't do it.
+ */
+int
+transfer_preallocate (struct transfer_endpoint *endpoint, off_t offset, off_t length)
+{
+        int ret;
+
+        if (length == 0) {
+                return 0;
+        }
+
+        if (endpoint->type == TRANSFER_GLUSTER) {
+                ret = glfs_fallocate (endpoint->glfd, FALLOC_FL_KEEP_SIZE, offset, length);
+        } else {
+                ret = fallocate (endpoint->fd, FALLOC_FL_KEEP_SIZE, offset, length);
+        }
+
+        if (ret == -1 && (errno == ENOSPC || errno == EDQUOT)) {
+                return -1;
+        }
+
+        return 0;
+}
+
+static int
+truncate_file (struct transfer_endpoint *endpoint, off_t size)
+{
+        if (endpoint->type == TRANSFER_GLUSTER) {
+#ifdef HAVE_GLFS_7_6
+                return glfs_ftruncate (endpoint->glfd, size, NULL, NULL);
+#else
+                return glfs_ftruncate (endpoint->glfd, size);
+#endif
+        }
+
+        return ftruncate (endpoint->fd, size);
+}
+
+static int
+sync_file (struct transfer_endpoint *endpoint)
+{
+        if (endpoint->type == TRANSFER_GLUSTER) {
+#ifdef HAVE_GLFS_7_6
+                return glfs_fsync (endpoint->glfd, NULL, NULL);
+#else
+                return glfs_fsync (endpoint->glfd);
+#endif
+        }
+
+        return fsync (endpoint->fd);
+}
+
+/**
+ * Empties the destination and sets it to its final size, which leaves it a
+ * single hole that the copied extents are written into. With reserve, the
+ * blocks are also preallocated, so that ranges written out of order neither
+ * race to extend the file nor fragment it.
+ */
+static int
+prepare_destination (struct transfer_endpoint *endpoint, off_t size, bool reserve)
+{
+        int ret;
+
+        ret = truncate_file (endpoint, 0);
+        if (ret == 0) {
+                ret = truncate_file (endpoint, size);
+        }
+
+        if (ret == -1 || !reserve) {
+                return ret;
+        }
+
+        return transfer_preallocate (endpoint, 0, size);
+}
+
+/**
+ * Sets the destination to the size of the source described by statbuf like
+ * prepare_destination (), but keeps what it holds, and sets kept to how much
+ * of that is left. Only the part it grows by is preallocated.
+ */
+static int
+keep_destination (struct transfer_endpoint *endpoint, const struct stat *statbuf,
+                  off_t *kept)
+{
+        off_t size;
+
+        if (file_size (endpoint, &size) == -1) {
+                return -1;
+        }
+
+        if (truncate_file (endpoint, statbuf->st_size) == -1) {
+                return -1;
+        }
+
+        *kept = size < statbuf->st_size ? size : statbuf->st_size;
+        if (transfer_is_sparse (statbuf)) {
+                return 0;
+        }
+
+        return transfer_preallocate (endpoint, *kept, statbuf->st_size - *kept);
+}
+
+/**
+ * Copies the data extents of src that fall within length bytes at offset to
+ * the same place in dst, skipping over holes, which the destination is
+ * expected to have already. A source whose storage can't report its extents
+ * is copied as a single extent. The holes still count as zeroes towards the
+ * checksum, if options ask for one. Returns 0 on success, or -1 with errno
+ * set; a source that ends early is an EIO, as its size was settled up front.
+ */
+static int
+copy_extents (struct transfer_endpoint *src, struct transfer_endpoint *dst,
+              off_t offset, off_t length, const struct transfer_options *options)
+{
+        uint32_t *checksum = options ? options->checksum : NULL;
+        off_t end = offset + length;
+        off_t data;
+        off_t hole;
+        off_t copied;
+
+        while (offset < end) {
+                data = endpoint_seek (src, offset, SEEK_DATA);
+                if (data == -1 && errno == ENXIO) {
+                        // Only a hole is left up to the end of the file.
+                        break;
+                } else if (data == -1 && errno != EINVAL && errno != ENOTSUP) {
+                        return -1;
+                } else if (data == -1) {
+                        data = offset;
+                        hole = end;
+                } else {
+                        hole = endpoint_seek (src, data, SEEK_HOLE);
+                        if (hole == -1) {
+                                return -1;
+                        }
+                }
+
+                if (data >= end) {
+                        break;
+                }
+
+                if (hole > end) {
+                        hole = end;
+                }
+
+                if (checksum) {
+                        *checksum = crc32c_zeros (*checksum, data - offset);
+                }
+
+                copied = transfer_range (src, dst, data, hole - data, options);
+                if (copied == -1) {
+                        return -1;
+                }
+
+                if (copied < hole - data) {
+                        errno = EIO;
+                        return -1;
+                }
+
+                offset = hole;
+        }
+
+        if (checksum) {
+                *checksum = crc32c_zeros (*checksum, end - offset);
+        }
+
+        return 0;
+}
+
+/**
+ * Copies the regular file src, described by statbuf, from its start into
+ * dst, recreating its holes instead of writing out their zeroes. File
+ * positions are left untouched. Returns 0 on success, or -1 with errno set.
+ */
+int
+transfer_sparse (struct transfer_endpoint *src, struct transfer_endpoint *dst,
+                 const struct stat *statbuf, const struct transfer_options *options)
+{
+        if (prepare_destination (dst, statbuf->st_size, false) == -1) {
+                return -1;
+        }
+
+        return copy_extents (src, dst, 0, statbuf->st_size, options);
+}
+
+/**
+ * State shared by the workers of a parallel transfer. Everything below lock
+ * is protected by it.
+ *
+ * dst: File to copy to, or NULL to only read src for its checksum.
+ * start/end: Byte range of the files to copy.
+ * chunk: Size of the ranges handed out to the workers.
+ * crcs: CRC32C of each range, if options ask for a checksum.
+ * journal: Journal of a resumed copy, whose ranges that are done are skipped
+ *          and which the others are recorded in as they complete, or NULL.
+ * dense_end: End of what dst held before, which is overwritten hole and all,
+ *            rather than copied into extent by extent.
+ * workers: Number of workers started so far.
+ * next: Offset of the next range to hand out.
+ * error: errno of the first failed range, or 0.
+ */
+struct parallel {
+        const struct transfer_file *src;
+        const struct transfer_file *dst;
+        const struct transfer_options *options;
+        off_t start;
+        off_t end;
+        off_t chunk;
+        uint32_t *crcs;
+        struct transfer_journal *journal;
+        off_t dense_end;
+        pthread_mutex_t lock;
+        unsigned int workers;
+        off_t next;
+        int error;
+};
+
+/**
+ * Copies one range of a parallel transfer, into a checksum of its own if
+ * there are any, since ranges finish in no particular order.
+ */
+static int
+copy_range (struct parallel *par, struct transfer_endpoint *src,
+            struct transfer_endpoint *dst, off_t offset, off_t length)
+{
+        const struct transfer_options *range_options = par->options;
+        struct transfer_options options;
+        off_t copied;
+
+        if (par->crcs) {
+                if (par->options) {
+                        options = *par->options;
+                } else {
+                        transfer_options_init (&options);
+                }
+
+                options.checksum = &par->crcs[(offset - par->start) / par->chunk];
+                *options.checksum = 0;
+                range_options = &options;
+        }
+
+        if (offset >= par->dense_end) {
+                // There's nothing there to compare with.
+                if (range_options && range_options->delta) {
+                        if (range_options != &options) {
+                                options = *range_options;
+                                range_options = &options;
+                        }
+
+                        options.delta = false;
+                }
+
+                return copy_extents (src, dst, offset, length, range_options);
+        }
+
+        copied = transfer_range (src, dst, offset, length, range_options);
+        if (copied == -1) {
+                return -1;
+        }
+
+        if (copied < length) {
+                errno = EIO;
+                return -1;
+        }
+
+        return 0;
+}
+
+/**
+ * Appends the range at index, just copied, to the journal, once the data is
+ * safely in dst. dst is the worker's own, so it is synced before par->lock is
+ * taken, which only guards the journal.
+ */
+static int
+record_range (struct parallel *par, struct transfer_endpoint *dst, size_t index)
+{
+        struct transfer_journal *journal = par->journal;
+        int ret = -1;
+
+        if (sync_file (dst) == -1) {
+                return -1;
+        }
+
+        pthread_mutex_lock (&par->lock);
+        journal->done[index] = true;
+        if (fprintf (journal->file, "%jd %08" PRIx32 "\n",
+                     (intmax_t) index * journal->chunk, journal->crcs[index]) < 0) {
+                goto out;
+        }
+
+        if (fflush (journal->file) == EOF) {
+                goto out;
+        }
+
+        ret = fsync (fileno (journal->file));
+out:
+        pthread_mutex_unlock (&par->lock);
+
+        return ret;
+}
+
+static void *
+parallel_worker (void *data)
+{
+        struct parallel *par = data;
+        struct transfer_endpoint src;
+        struct transfer_endpoint dst;
+        off_t offset;
+        off_t length;
+        size_t index;
+        unsigned int worker;
+        int err = 0;
+
+        pthread_mutex_lock (&par->lock);
+        worker = par->workers++;
+        pthread_mutex_unlock (&par->lock);
+
+        if (open_file (par->src, worker, O_RDONLY, &src) == -1) {
+                err = errno;
+                goto out;
+        }
+
+        if (par->dst == NULL) {
+                transfer_discard (&dst);
+        } else if (open_file (par->dst, worker,
+                              par->options && (par->options->delta || par->options->mmap)
+                                ? O_RDWR : O_WRONLY,
+                              &dst) == -1) {
+                err = errno;
+                goto close_src;
+        }
+
+        for (;;) {
+                pthread_mutex_lock (&par->lock);
+                offset = par->next;
+                if (par->error != 0 || offset >= par->end) {
+                        pthread_mutex_unlock (&par->lock);
+                        break;
+                }
+
+                length = par->end - offset;
+                if (length > par->chunk) {
+                        length = par->chunk;
+                }
+
+                par->next += length;
+                pthread_mutex_unlock (&par->lock);
+
+                index = (offset - par->start) / par->chunk;
+                if (par->journal && par->journal->done[index]) {
+                        continue;
+                }
+
+                if (copy_range (par, &src, &dst, offset, length) == -1) {
+                        err = errno;
+                        break;
+                }
+
+                if (par->journal && record_range (par, &dst, index) == -1) {
+                        err = errno;
+                        break;
+                }
+        }
+
+        if (par->dst && close_file (&dst) == -1 && err == 0) {
+                err = errno;
+        }
+
+close_src:
+        close_file (&src);
+out:
+        if (err != 0) {
+                pthread_mutex_lock (&par->lock);
+                if (par->error == 0) {
+                        par->error = err;
+                }
+                pthread_mutex_unlock (&par->lock);
+        }
+
+        return NULL;
+}
+
+/**
+ * Returns the size of the pieces that length bytes are split into for jobs
+ * workers: enough for every job to get a few, so that one slow piece doesn't
+ * leave the others idle at the end, but not so many that the fops for a piece
+ * never get to fill the queue.
+ */
+static off_t
+chunk_size (off_t length, unsigned int jobs, const struct transfer_options *options)
+{
+        size_t unit = options ? buffer_size (options) : BUFSIZE;
+        off_t chunk;
+
+        chunk = length / (jobs * 4) + 1;
+        chunk = (chunk + unit - 1) / unit * unit;
+        if (chunk > TRANSFER_MAX_CHUNK) {
+                chunk = TRANSFER_MAX_CHUNK;
+        }
+
+        return chunk;
+}
+
+/**
+ * Runs jobs workers over the ranges of par until all are copied or one
+ * fails, then adds the checksums of the ranges, in order, to the checksum of
+ * the options. The checksums are kept in par->crcs if given, as they are for
+ * a journal. Returns 0 on success, or -1 with errno set.
+ */
+static int
+run_parallel (struct parallel *par, unsigned int jobs)
+{
+        uint32_t *checksum = par->options ? par->options->checksum : NULL;
+        size_t nranges = (par->end - par->start + par->chunk - 1) / par->chunk;
+        uint32_t *crcs = NULL;
+        pthread_t *workers;
+        unsigned int started;
+        off_t offset;
+        size_t i;
+        int ret;
+
+        if (par->crcs == NULL && checksum && nranges > 0) {
+                crcs = calloc (nranges, sizeof (*crcs));
+                if (crcs == NULL) {
+                        return -1;
+                }
+
+                par->crcs = crcs;
+        }
+
+        workers = calloc (jobs, sizeof (*workers));
+        if (workers == NULL) {
+                free (crcs);
+                return -1;
+        }
+
+        pthread_mutex_init (&par->lock, NULL);
+        par->next = par->start;
+
+        for (started = 0; started < jobs; started++) {
+                ret = pthread_create (&workers[started], NULL, parallel_worker, par);
+                if (ret != 0) {
+                        pthread_mutex_lock (&par->lock);
+                        if (par->error == 0) {
+                                par->error = ret;
+                        }
+                        pthread_mutex_unlock (&par->lock);
+                        break;
+                }
+        }
+
+        while (started > 0) {
+                pthread_join (workers[--started], NULL);
+        }
+
+        pthread_mutex_destroy (&par->lock);
+        free (workers);
+
+        if (par->error == 0 && checksum && par->crcs) {
+                for (i = 0, offset = par->start; i < nranges; i++, offset += par->chunk) {
+                        *checksum = crc32c_combine (*checksum, par->crcs[i],
+                                                    par->end - offset < par->chunk
+                                                        ? par->end - offset
+                                                        : par->chunk);
+                }
+        }
+
+        free (crcs);
+
+        if (par->error != 0) {
+                errno = par->error;
+                return -1;
+        }
+
+        return 0;
+}
+
+/**
+ * Copies the regular file src, described by statbuf, into dst using
+ * options->jobs workers, each with its own pair of fds, that copy disjoint
+ * byte ranges of the file at once. The workers are spread over the
+ * connections of each side. dst must already exist; it is set to the size of
+ * src up front, preallocated unless src has holes to recreate, and its size is
+ * checked once every range has been copied. For a delta transfer, whatever dst
+ * held is kept, and only the blocks that differ from src are written. Returns
+ * 0 on success, or -1 with errno set.
+ */
+int
+transfer_parallel (const struct transfer_file *src, const struct transfer_file *dst,
+                   const struct stat *statbuf, const struct transfer_options *options)
+{
+        off_t size = statbuf->st_size;
+        struct parallel par = {
+                .src = src,
+                .dst = dst,
+                .options = options,
+                .start = 0,
+                .end = size,
+        };
+        struct transfer_endpoint endpoint;
+        unsigned int jobs = options ? options->jobs : 1;
+        off_t dst_size = -1;
+        int ret = -1;
+
+        par.chunk = chunk_size (size, jobs, options);
+
+        // Ranges that start on stripe boundaries keep the writes of every
+        // job to whole stripes.
+        if (dst->type == TRANSFER_GLUSTER && dst->conns->stripe > 0
+                        && par.chunk > dst->conns->stripe) {
+                par.chunk -= par.chunk % dst->conns->stripe;
+        }
+
+        if (open_file (dst, 0, O_WRONLY, &endpoint) == -1) {
+                return -1;
+        }
+
+        if (options && options->delta) {
+                ret = keep_destination (&endpoint, statbuf, &par.dense_end);
+        } else {
+                ret = prepare_destination (&endpoint, size, !transfer_is_sparse (statbuf));
+        }
+
+        if (ret == -1) {
+                goto close;
+        }
+
+        ret = -1;
+
+        if (run_parallel (&par, jobs) == -1) {
+                goto close;
+        }
+
+        if (file_size (&endpoint, &dst_size) == -1) {
+                goto close;
+        }
+
+        if (dst_size != size) {
+                errno = EIO;
+                goto close;
+        }
+
+        ret = 0;
+
+close:
+        if (close_file (&endpoint) == -1) {
+                ret = -1;
+        }
+
+        return ret;
+}
+
+/**
+ * Opens the journal at path of a resumable copy of the regular file described
+ * by statbuf, creating it if need be. The ranges it lists are only taken as
+ * done if it was written for the same version of the same file; they are
+ * checked against the destination by transfer_resume () before anything is
+ * skipped. Returns 0 on success, or -1 with errno set.
+ */
+int
+transfer_journal_open (struct transfer_journal *journal, const char *path,
+                       const struct stat *statbuf,
+                       const struct transfer_options *options)
+{
+        char line[sizeof (journal->tag) + 32];
+        bool valid = false;
+        size_t length;
+        intmax_t offset;
+        uint32_t crc;
+        char *end;
+        int fd;
+
+        journal->path = path;
+        journal->done = NULL;
+        journal->crcs = NULL;
+        snprintf (journal->tag, sizeof (journal->tag),
+                  "glfs-transfer-journal 1 %jd %jd.%09ld %ju",
+                  (intmax_t) statbuf->st_size, (intmax_t) statbuf->st_mtim.tv_sec,
+                  statbuf->st_mtim.tv_nsec, (uintmax_t) statbuf->st_ino);
+        journal->chunk = chunk_size (statbuf->st_size, options ? options->jobs : 1,
+                                     options);
+
+        fd = open (path, O_RDWR | O_CREAT, 0666);
+        if (fd == -1) {
+                return -1;
+        }
+
+        journal->file = fdopen (fd, "r+");
+        if (journal->file == NULL) {
+                close (fd);
+                return -1;
+        }
+
+        // A journal of another file, or of this one before it changed, is
+        // of no use; its ranges are then simply not read.
+        length = strlen (journal->tag);
+        if (fgets (line, sizeof (line), journal->file)
+                        && strncmp (line, journal->tag, length) == 0
+                        && line[length] == ' ') {
+                offset = strtoimax (&line[length + 1], &end, 10);
+                if (*end == '\n' && offset > 0) {
+                        journal->chunk = offset;
+                        valid = true;
+                }
+        }
+
+        journal->nranges = (statbuf->st_size + journal->chunk - 1) / journal->chunk;
+        if (journal->nranges > 0) {
+                journal->done = calloc (journal->nranges, sizeof (*journal->done));
+                journal->crcs = calloc (journal->nranges, sizeof (*journal->crcs));
+                if (journal->done == NULL || journal->crcs == NULL) {
+                        transfer_journal_close (journal, false);
+                        return -1;
+                }
+        }
+
+        while (valid && fscanf (journal->file, "%jd %" SCNx32 "\n", &offset, &crc) == 2) {
+                if (offset >= 0 && offset % journal->chunk == 0
+                                && offset < statbuf->st_size) {
+                        journal->done[offset / journal->chunk] = true;
+                        journal->crcs[offset / journal->chunk] = crc;
+                }
+        }
+
+        return 0;
+}
+
+/**
+ * Closes journal, and removes it once the copy it was kept for is finished.
+ */
+void
+transfer_journal_close (struct transfer_journal *journal, bool finished)
+{
+        fclose (journal->file);
+        if (finished) {
+                unlink (journal->path);
+        }
+
+        free (journal->done);
+        free (journal->crcs);
+}
+
+/**
+ * Replaces the content of journal with its tag and the ranges that are done.
+ */
+static int
+rewrite_journal (struct transfer_journal *journal)
+{
+        size_t i;
+
+        if (fflush (journal->file) == EOF || ftruncate (fileno (journal->file), 0) == -1) {
+                return -1;
+        }
+
+        rewind (journal->file);
+        fprintf (journal->file, "%s %jd\n", journal->tag, (intmax_t) journal->chunk);
+        for (i = 0; i < journal->nranges; i++) {
+                if (journal->done[i]) {
+                        fprintf (journal->file, "%jd %08" PRIx32 "\n",
+                                 (intmax_t) i * journal->chunk, journal->crcs[i]);
+                }
+        }
+
+        if (fflush (journal->file) == EOF) {
+                return -1;
+        }
+
+        return fsync (fileno (journal->file));
+}
+
+/**
+ * Reads back the ranges of the journal that are done from dst, whose size is
+ * dst_size, and forgets those that aren't there or don't match their
+ * checksum, so that they are copied again.
+ */
+static int
+check_journal (struct transfer_journal *journal, const struct transfer_file *dst,
+               off_t dst_size, off_t size, const struct transfer_options *options)
+{
+        off_t offset;
+        off_t length;
+        uint32_t crc;
+        size_t i;
+
+        for (i = 0; i < journal->nranges; i++) {
+                if (!journal->done[i]) {
+                        continue;
+                }
+
+                offset = i * journal->chunk;
+                length = size - offset < journal->chunk ? size - offset : journal->chunk;
+                if (offset + length > dst_size) {
+                        journal->done[i] = false;
+                        continue;
+                }
+
+                if (transfer_checksum (dst, offset, length, options, &crc) == -1) {
+                        return -1;
+                }
+
+                journal->done[i] = crc == journal->crcs[i];
+        }
+
+        return rewrite_journal (journal);
+}
+
+/**
+ * Copies the regular file src, described by statbuf, into dst like
+ * transfer_parallel (), but without starting over: dst is kept, the ranges
+ * that journal lists as done are checked against it, and only the others are
+ * copied, each recorded in the journal as soon as it is safely in dst. What
+ * dst held before is overwritten rather than punched out, so it can't show
+ * through the holes of a sparse src. Returns 0 on success, or -1 with errno
+ * set.
+ */
+int
+transfer_resume (const struct transfer_file *src, const struct transfer_file *dst,
+                 const struct stat *statbuf, const struct transfer_options *options,
+                 struct transfer_journal *journal)
+{
+        off_t size = statbuf->st_size;
+        struct parallel par = {
+                .src = src,
+                .dst = dst,
+                .options = options,
+                .start = 0,
+                .end = size,
+                .chunk = journal->chunk,
+                .crcs = journal->crcs,
+                .journal = journal,
+        };
+        struct transfer_endpoint endpoint;
+        unsigned int jobs = options ? options->jobs : 1;
+        off_t dst_size = -1;
+        int ret = -1;
+
+        if (open_file (dst, 0, O_WRONLY, &endpoint) == -1) {
+                return -1;
+        }
+
+        if (file_size (&endpoint, &dst_size) == -1) {
+                goto close;
+        }
+
+        if (check_journal (journal, dst, dst_size, size, options) == -1) {
+                goto close;
+        }
+
+        if (keep_destination (&endpoint, statbuf, &par.dense_end) == -1) {
+                goto close;
+        }
+
+        if (run_parallel (&par, jobs) == -1) {
+                goto close;
+        }
+
+        if (file_size (&endpoint, &dst_size) == -1) {
+                goto close;
+        }
+
+        if (dst_size != size) {
+                errno = EIO;
+                goto close;
+        }
+
+        ret = 0;
+
+close:
+        if (close_file (&endpoint) == -1) {
+                ret = -1;
+        }
+
+        return ret;
+}
+
+/**
+ * Copies src from its start into dst within the storage, without the data
+ * passing through this client, and cuts dst off where the copy ended. Both
+ * files must be on the same volume. Returns 0 on success, or -1 with errno
+ * set; ENOSYS, EOPNOTSUPP and EXDEV mean the copy has to be done by streaming
+ * instead.
+ */
+int
+transfer_server_copy (struct transfer_endpoint *src, struct transfer_endpoint *dst)
+{
+#ifdef HAVE_GLFS_COPY_FILE_RANGE
+        off64_t src_offset = 0;
+        off64_t dst_offset = 0;
+        size_t chunk = transfer_limit_chunk (TRANSFER_MAX_CHUNK);
+        struct timespec start;
+        uint64_t entered;
+        off_t size;
+        ssize_t ret;
+
+        if (file_size (src, &size) == -1) {
+                return -1;
+        }
+
+        while (src_offset < size) {
+                transfer_limit (size - src_offset < chunk ? size - src_offset : chunk);
+                entered = transfer_limit_enter ();
+                transfer_stats_clock (&start);
+                ret = glfs_copy_file_range (src->glfd, &src_offset,
+                                            dst->glfd, &dst_offset,
+                                            size - src_offset < chunk
+                                                ? size - src_offset
+                                                : chunk,
+                                            0, NULL, NULL, NULL);
+                transfer_limit_leave (entered);
+                transfer_stats_fop (TRANSFER_FOP_COPY, ret, &start);
+                if (ret == -1) {
+                        return -1;
+                }
+
+                // The source shrank underneath us.
+                if (ret == 0) {
+                        break;
+                }
+        }
+
+#ifdef HAVE_GLFS_7_6
+        return glfs_ftruncate (dst->glfd, dst_offset, NULL, NULL);
+#else
+        return glfs_ftruncate (dst->glfd, dst_offset);
+#endif
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+}
+
+/**
+ * Computes the CRC32C of length bytes of file at offset by reading them back,
+ * in options->jobs byte ranges at once like a parallel transfer, and without
+ * reading its holes. options may be NULL for the defaults. Returns 0 on
+ * success, or -1 with errno set; EIO if the file is shorter than that.
+ */
+int
+transfer_checksum (const struct transfer_file *file, off_t offset, off_t length,
+                   const struct transfer_options *options, uint32_t *crc)
+{
+        struct transfer_options read_options;
+        struct parallel par = {
+                .src = file,
+                .dst = NULL,
+                .options = &read_options,
+                .start = offset,
+                .end = offset + length,
+        };
+
+        if (options) {
+                read_options = *options;
+        } else {
+                transfer_options_init (&read_options);
+        }
+
+        *crc = 0;
+        read_options.checksum = crc;
+
+        par.chunk = chunk_size (length, read_options.jobs, &read_options);
+
+        return run_parallel (&par, read_options.jobs);
+}
+
+/**
+ * Writes the checksum crc of the file called name to file, in the same layout
+ * as the output of sha256sum and friends. A line is written at once, so many
+ * threads may share file.
+ */
+int
+transfer_write_checksum (FILE *file, const char *name, uint32_t crc)
+{
+        if (fprintf (file, "%08" PRIx32 "  %s\n", crc, name) < 0) {
+                return -1;
+        }
+
+        return fflush (file);
+}
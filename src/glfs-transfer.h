@@ -0,0 +1,270 @@
+/**
+ * Copyright (C) 2015 Facebook Inc.
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GLFS_TRANSFER_H
+#define GLFS_TRANSFER_H
+
+#include "glfs-transfer-limit.h"
+#include "glfs-transfer-stats.h"
+
+#include <glusterfs/api/glfs.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+// Minimum number of buffers shared between the reader and the writer.
+#define TRANSFER_SLOTS 4
+#define TRANSFER_MAX_QUEUE_DEPTH 64
+#define TRANSFER_MAX_JOBS 64
+#define TRANSFER_MAX_CONNECTIONS 16
+#define TRANSFER_MAX_BUFFERS 256
+#define TRANSFER_MIN_BUFFER_SIZE (4 * 1024)
+#define TRANSFER_MAX_BUFFER_SIZE (64 * 1024 * 1024)
+// Range explored by --block-size=auto, unless the buffers are smaller.
+#define TRANSFER_AUTO_MIN_BLOCK (64 * 1024)
+#define TRANSFER_AUTO_MAX_BLOCK (4 * 1024 * 1024)
+// Upper bound on the byte range handed to one job of a parallel transfer.
+#define TRANSFER_MAX_CHUNK (64 * 1024 * 1024)
+
+/**
+ * Long option values for the transfer tuning flags shared by the data
+ * moving utilities. They start above the range of short option characters.
+ */
+enum transfer_option {
+        TRANSFER_OPTION_QUEUE_DEPTH = 256,
+        TRANSFER_OPTION_JOBS,
+        TRANSFER_OPTION_CONNECTIONS,
+        TRANSFER_OPTION_BUFFER_SIZE,
+        TRANSFER_OPTION_BUFFERS,
+        TRANSFER_OPTION_HUGE_PAGES,
+        TRANSFER_OPTION_BLOCK_SIZE,
+        TRANSFER_OPTION_STATS,
+        TRANSFER_OPTION_STATS_INTERVAL,
+        TRANSFER_OPTION_VERIFY,
+        TRANSFER_OPTION_CHECKSUM_OUT,
+        TRANSFER_OPTION_RESUME,
+        TRANSFER_OPTION_DELTA,
+        TRANSFER_OPTION_BWLIMIT,
+        TRANSFER_OPTION_IOPS_LIMIT,
+        TRANSFER_OPTION_TARGET_LATENCY,
+        TRANSFER_OPTION_IO_URING,
+        TRANSFER_OPTION_MMAP,
+        TRANSFER_OPTION_BRICK_JOBS,
+        TRANSFER_OPTION_DIRECT
+};
+
+/**
+ * One side of a data transfer: either a local file descriptor or an open
+ * file on a Gluster volume. A TRANSFER_DISCARD destination drops the data,
+ * for transfers done only for their checksum.
+ */
+enum transfer_type {
+        TRANSFER_LOCAL,
+        TRANSFER_GLUSTER,
+        TRANSFER_DISCARD
+};
+
+/**
+ * glfds holds glfd followed by fds for the same file opened over other
+ * connections to its volume; asynchronous fops are spread across all of them.
+ * stripe is the stripe width of the volume, or 0 if unknown or unstriped.
+ */
+struct transfer_endpoint {
+        enum transfer_type type;
+        int fd;
+        glfs_fd_t *glfd;
+        glfs_fd_t *glfds[TRANSFER_MAX_CONNECTIONS];
+        unsigned int nglfds;
+        size_t stripe;
+};
+
+/**
+ * Independent connections to the same volume, each with a client graph and
+ * event threads of its own. fs[0] is the connection everything else is done
+ * on; the others only carry file data. stripe is the stripe width of the
+ * volume, as found by gluster_stripe_width ().
+ */
+struct transfer_connections {
+        glfs_t *fs[TRANSFER_MAX_CONNECTIONS];
+        unsigned int count;
+        size_t stripe;
+};
+
+/**
+ * A file named by path, for transfers that open their own fds on it. conns is
+ * NULL for a local file.
+ */
+struct transfer_file {
+        enum transfer_type type;
+        const struct transfer_connections *conns;
+        const char *path;
+};
+
+/**
+ * User tunables for a transfer.
+ *
+ * queue_depth: Number of asynchronous reads or writes kept in flight on the
+ *              Gluster side(s) of the transfer. 1 uses blocking calls.
+ * jobs: Number of byte ranges of a single file copied at once by a parallel
+ *       transfer.
+ * brick_jobs: Number of files copied at once from any one subvolume of a
+ *             Gluster source by a copy of many files, or 0 for no limit.
+ * connections: Number of connections opened to each Gluster volume.
+ * buffer_size: Size of each transfer buffer, or 0 to fit the block size.
+ * buffers: Number of buffers per transfer, or 0 to size it to the queue depth.
+ * huge_pages: Whether large buffers are backed by transparent huge pages.
+ * block_size: Size of each read and write, or 0 for the buffer size.
+ * auto_block_size: Whether the block size is picked from the layout of the
+ *                  files and tuned to the throughput during the transfer.
+ * stats: Format of the statistics reported at exit, if any.
+ * stats_interval: Seconds between statistics reports, or 0 for none.
+ * verify: Whether the destination is read back and checked against the
+ *         checksum of the data sent to it.
+ * checksum_file: File to record the checksum of the data in, or NULL.
+ * checksum: CRC32C that the data is added to as it goes by, or NULL.
+ * journal: Local file that a resumable copy keeps its progress in, or NULL.
+ * delta: Whether the destination is read and only the blocks that differ
+ *        from the source are written.
+ * bwlimit: Bytes per second that all the transfers together may read, or 0.
+ * iops_limit: Fops per second that all the transfers together may issue, or 0.
+ * target_latency: Latency in nanoseconds that the fops on Gluster are held to
+ *                 by adjusting how many of them are in flight, or 0.
+ * io_uring: Whether local regular files are read and written through
+ *           io_uring, queue_depth fops at a time, instead of blocking calls.
+ * mmap: Whether a local regular file copied to or from Gluster is mapped into
+ *       memory, for the Gluster fops to read from and write into directly.
+ * direct: Whether local regular files are kept out of the page cache, with
+ *         O_DIRECT where they can be.
+ */
+struct transfer_options {
+        unsigned int queue_depth;
+        unsigned int jobs;
+        unsigned int brick_jobs;
+        unsigned int connections;
+        size_t buffer_size;
+        unsigned int buffers;
+        bool huge_pages;
+        size_t block_size;
+        bool auto_block_size;
+        enum transfer_stats_format stats;
+        unsigned int stats_interval;
+        bool verify;
+        const char *checksum_file;
+        uint32_t *checksum;
+        const char *journal;
+        bool delta;
+        uint64_t bwlimit;
+        unsigned int iops_limit;
+        uint64_t target_latency;
+        bool io_uring;
+        bool mmap;
+        bool direct;
+};
+
+/**
+ * Progress of a resumable copy of a regular file, kept in a local file so
+ * that a copy that was cut short can pick up where it stopped.
+ *
+ * path/file: The journal file, open for reading and writing.
+ * tag: First words of the journal, which tie it to one version of the source.
+ * chunk: Size of the byte ranges that the source is copied in.
+ * nranges: Number of such ranges.
+ * done: Whether each range is believed to be in the destination.
+ * crcs: CRC32C of each range that is done.
+ */
+struct transfer_journal {
+        const char *path;
+        FILE *file;
+        char tag[128];
+        off_t chunk;
+        size_t nranges;
+        bool *done;
+        uint32_t *crcs;
+};
+
+void
+transfer_options_init (struct transfer_options *options);
+
+int
+parse_transfer_option (int opt, const char *arg, struct transfer_options *options);
+
+void
+transfer_local (struct transfer_endpoint *endpoint, int fd);
+
+void
+transfer_gluster (struct transfer_endpoint *endpoint, glfs_fd_t *glfd);
+
+void
+transfer_discard (struct transfer_endpoint *endpoint);
+
+int
+transfer_open_connections (struct transfer_endpoint *endpoint,
+                           const struct transfer_connections *conns,
+                           const char *path, int flags);
+
+void
+transfer_close_connections (struct transfer_endpoint *endpoint);
+
+int
+transfer (struct transfer_endpoint *src, struct transfer_endpoint *dst,
+          const struct transfer_options *options);
+
+off_t
+transfer_range (struct transfer_endpoint *src, struct transfer_endpoint *dst,
+                off_t offset, off_t length,
+                const struct transfer_options *options);
+
+bool
+transfer_is_sparse (const struct stat *statbuf);
+
+int
+transfer_preallocate (struct transfer_endpoint *endpoint, off_t offset, off_t length);
+
+int
+transfer_sparse (struct transfer_endpoint *src, struct transfer_endpoint *dst,
+                 const struct stat *statbuf, const struct transfer_options *options);
+
+int
+transfer_parallel (const struct transfer_file *src, const struct transfer_file *dst,
+                   const struct stat *statbuf, const struct transfer_options *options);
+
+int
+transfer_journal_open (struct transfer_journal *journal, const char *path,
+                       const struct stat *statbuf,
+                       const struct transfer_options *options);
+
+void
+transfer_journal_close (struct transfer_journal *journal, bool finished);
+
+int
+transfer_resume (const struct transfer_file *src, const struct transfer_file *dst,
+                 const struct stat *statbuf, const struct transfer_options *options,
+                 struct transfer_journal *journal);
+
+int
+transfer_server_copy (struct transfer_endpoint *src, struct transfer_endpoint *dst);
+
+int
+transfer_checksum (const struct transfer_file *file, off_t offset, off_t length,
+                   const struct transfer_options *options, uint32_t *crc);
+
+int
+transfer_write_checksum (FILE *file, const char *name, uint32_t crc);
+
+#endif /* GLFS_TRANSFER_H */
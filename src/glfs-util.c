@@ -21,21 +21,51 @@
 #include <config.h>
 
 #include "glfs-util.h"
+#include "glfs-transfer.h"
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <assert.h>
 #include <errno.h>
 #include <error.h>
 #include <glusterfs/api/glfs.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
+#include <unistd.h>
 
 #define GLFS_MIN_URL_LENGTH 11
-#define LOG_EVERY_SECS 30
+
+// Transparent huge pages are only worth asking for from this size on.
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// A volume ID is the UUID of the volume.
+#define GLFS_VOLUME_ID_SIZE 16
+
+/**
+ * Buffers handed back by finished transfers, kept for the next one. In gfcli
+ * this lets every command of a session reuse the memory of the previous ones
+ * instead of allocating and faulting in its buffers all over again.
+ *
+ * idle: Buffers ready for reuse, with the size and kind of pages they were
+ *       allocated with.
+ * idle_bytes: Total size of the idle buffers, kept under BUFFER_POOL_MAX_BYTES.
+ */
+static struct {
+        pthread_mutex_t lock;
+        struct {
+                void *buf;
+                size_t size;
+                bool huge_pages;
+        } idle[BUFFER_POOL_MAX_IDLE];
+        unsigned int nidle;
+        size_t idle_bytes;
+} buffer_pool = {
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 int
 append_xlator_option (struct xlator_option **options, struct xlator_option *option)
@@ -341,124 +371,318 @@ gluster_lock (glfs_fd_t *fd, short type, bool block) {
     return glfs_posix_lock (fd, block ? F_SETLKW : F_SETLK, &flck);
 }
 
+/**
+ * Streams everything readable from the local descriptor src into fd. options
+ * may be NULL for the defaults. Returns 0 on success and -1 on error.
+ */
 int
-gluster_write (int src, glfs_fd_t *fd) {
-        char buffer[BUFSIZE];
-        size_t num_read = 0;
-        size_t num_written = 0;
-        size_t ret = 0;
-        size_t total_written = 0;
-        time_t time_start = time (NULL);
-        time_t time_last = time_start;
-        time_t time_cur = time_start;
-
-        while (true) {
-                num_read = read (src, buffer, BUFSIZE);
-                if (num_read == -1) {
-                        ret = -1;
-                        goto out;
-                }
+gluster_write (int src, glfs_fd_t *fd, const struct transfer_options *options) {
+        struct transfer_endpoint source;
+        struct transfer_endpoint dest;
 
-                if (num_read == 0) {
-                        goto out;
-                }
+        transfer_local (&source, src);
+        transfer_gluster (&dest, fd);
 
-                for (num_written = 0; num_written < num_read;) {
-                        ret = glfs_write (fd,
-                                          &buffer[num_written],
-                                          num_read - num_written, 0);
-                        if (ret == -1) {
-                                goto out;
-                        }
+        return transfer (&source, &dest, options);
+}
+
+/**
+ * Streams fd from its current offset to the end into the local descriptor
+ * dst. options may be NULL for the defaults. Returns 0 on success and -1 on
+ * error.
+ */
+int
+gluster_read (glfs_fd_t *fd, int dst, const struct transfer_options *options) {
+        struct transfer_endpoint source;
+        struct transfer_endpoint dest;
 
-                        num_written += ret;
-                        total_written += ret;
+        transfer_gluster (&source, fd);
+        transfer_local (&dest, dst);
 
-                        time_cur = time (NULL);
-                        if (time_cur - time_last > LOG_EVERY_SECS) {
-                                time_last = time_cur;
-                                fprintf (stderr,
-                                         "Wrote: %zu. Time: %zu\n",
-                                         total_written,
-                                         time_cur - time_start);
-                        }
-                }
+        return transfer (&source, &dest, options);
+}
+
+int
+gluster_getfs (glfs_t **fs, const struct gluster_url *gluster_url) {
+        int ret = 0;
+
+        *fs = glfs_new (gluster_url->volume);
+        if (*fs == NULL) {
+                ret = -1;
+                goto out;
         }
 
+        ret = glfs_set_volfile_server (*fs,
+                        "tcp",
+                        gluster_url->host,
+                        gluster_url->port);
+        if (ret == -1) {
+                goto out;
+        }
+
+        ret = glfs_init (*fs);
+
 out:
         return ret;
 }
 
+/**
+ * Fills conns with fs followed by count - 1 new connections to the volume of
+ * gluster_url, set up with the same translator options. Only the new
+ * connections belong to conns; fs stays with the caller.
+ */
 int
-gluster_read (glfs_fd_t *fd, int dst) {
-        char buffer[BUFSIZE];
-        size_t num_read = 0;
-        size_t num_written = 0;
-        size_t ret = 0;
-        size_t total_written = 0;
-        time_t time_start = time (NULL);
-        time_t time_last = time_start;
-        time_t time_cur = time_start;
-
-        while (true) {
-                num_read = glfs_read (fd, buffer, BUFSIZE, 0);
-                if (num_read == -1) {
-                        goto out;
+gluster_getfs_connections (struct transfer_connections *conns, glfs_t *fs,
+                unsigned int count, const struct gluster_url *gluster_url,
+                struct xlator_option **options)
+{
+        glfs_t *extra_fs;
+        int ret = 0;
+
+        conns->fs[0] = fs;
+        conns->count = 1;
+        conns->stripe = gluster_stripe_width (fs);
+
+        while (conns->count < count) {
+                ret = gluster_getfs (&extra_fs, gluster_url);
+                if (ret == 0) {
+                        ret = apply_xlator_options (extra_fs, options);
                 }
 
-                if (num_read == 0) {
+                if (ret == -1) {
+                        if (extra_fs) {
+                                glfs_fini (extra_fs);
+                        }
+
+                        gluster_fini_connections (conns);
                         goto out;
                 }
 
-                for (num_written = 0; num_written < num_read;) {
-                        ret = write (dst,
-                                     &buffer[num_written],
-                                     num_read - num_written);
-                        if (ret != (num_read - num_written)) {
-                                goto err;
+                conns->fs[conns->count++] = extra_fs;
+        }
+
+out:
+        return ret;
+}
+
+void
+gluster_fini_connections (struct transfer_connections *conns)
+{
+        while (conns->count > 1) {
+                glfs_fini (conns->fs[--conns->count]);
+        }
+
+        conns->count = 0;
+}
+
+/**
+ * Returns the volfile of the volume behind fs as a string, or NULL if it isn't
+ * available. The caller must free it.
+ */
+static char *
+get_volfile (glfs_t *fs)
+{
+#ifdef HAVE_GLFS_GET_VOLFILE
+        char *volfile = NULL;
+        char *tmp;
+        size_t len = 16 * 1024;
+        ssize_t ret;
+
+        // A negative return is the size the volfile needs; try again with
+        // that much, which only fails if the volfile changes in between.
+        for (int tries = 0; tries < 4; tries++) {
+                tmp = realloc (volfile, len + 1);
+                if (tmp == NULL) {
+                        break;
+                }
+
+                volfile = tmp;
+                ret = glfs_get_volfile (fs, volfile, len);
+                if (ret > 0) {
+                        volfile[ret] = '\0';
+                        return volfile;
+                } else if (ret == 0 || (size_t) -ret <= len) {
+                        break;
+                }
+
+                len = -ret;
+        }
+
+        free (volfile);
+#endif
+        return NULL;
+}
+
+/**
+ * Returns the number of bytes in a full stripe of the volume behind fs: the
+ * data fragments of all the bricks of a disperse subvolume, each 512 bytes.
+ * Writes that aren't made of whole stripes force the bricks to read back and
+ * re-encode the rest. Returns 0 if the volume isn't dispersed, or its layout
+ * is unknown.
+ */
+size_t
+gluster_stripe_width (glfs_t *fs)
+{
+        char *volfile;
+        char *line;
+        char *saveptr;
+        char *word;
+        bool disperse = false;
+        unsigned long redundancy = 0;
+        unsigned long subvols = 0;
+        size_t width = 0;
+
+        volfile = get_volfile (fs);
+        if (volfile == NULL) {
+                return 0;
+        }
+
+        // All disperse subvolumes of a volume share the same geometry, so the
+        // first one is enough.
+        for (line = strtok_r (volfile, "\n", &saveptr);
+             line != NULL;
+             line = strtok_r (NULL, "\n", &saveptr)) {
+                line += strspn (line, " \t");
+
+                if (strncmp (line, "volume ", 7) == 0) {
+                        disperse = false;
+                        redundancy = 0;
+                        subvols = 0;
+                } else if (strncmp (line, "type ", 5) == 0) {
+                        disperse = strstr (line, "cluster/disperse") != NULL;
+                } else if (strncmp (line, "option redundancy ", 18) == 0) {
+                        redundancy = strtoul (&line[18], NULL, 10);
+                } else if (strncmp (line, "subvolumes ", 11) == 0) {
+                        for (word = &line[11]; *word != '\0';) {
+                                word += strspn (word, " \t");
+                                if (*word == '\0') {
+                                        break;
+                                }
+
+                                subvols++;
+                                word += strcspn (word, " \t");
                         }
+                } else if (strncmp (line, "end-volume", 10) == 0
+                                && disperse && subvols > redundancy) {
+                        width = (subvols - redundancy) * 512;
+                        break;
+                }
+        }
+
+        free (volfile);
 
-                        num_written += ret;
-                        total_written += ret;
+        return width;
+}
 
-                        time_cur = time (NULL);
-                        if (time_cur - time_last > LOG_EVERY_SECS) {
-                                time_last = time_cur;
-                                fprintf (stderr,
-                                         "Read: %zu. Time: %zu\n",
-                                         total_written,
-                                         time_cur - time_start);
+/**
+ * Returns the name of the subvolume of the volume behind fs that holds the
+ * file at path, from its glusterfs.pathinfo: the replica or disperse set it
+ * is on, or its brick on a plain distributed volume. pathinfo nests the
+ * translators that the file goes through, such as
+ *
+ *   (<DISTRIBUTE:vol-dht> (<REPLICATE:vol-replicate-0> <POSIX(/b):host:/b/f> ...))
+ *
+ * of which the first one below the distribution layer is the one wanted.
+ * Returns NULL with errno set if the file can't be looked up or its layout
+ * isn't known. The caller must free the name.
+ */
+char *
+gluster_get_subvolume (glfs_t *fs, const char *path)
+{
+        char *pathinfo = NULL;
+        char *tmp;
+        char *tag;
+        char *end;
+        size_t len = 1024;
+        ssize_t ret;
+
+        // ERANGE means the buffer was too small; ask for the size, and try
+        // again with that much.
+        for (int tries = 0; tries < 4; tries++) {
+                tmp = realloc (pathinfo, len + 1);
+                if (tmp == NULL) {
+                        goto err;
+                }
+
+                pathinfo = tmp;
+                ret = glfs_getxattr (fs, path, "glusterfs.pathinfo", pathinfo, len);
+                if (ret >= 0) {
+                        pathinfo[ret] = '\0';
+                        break;
+                } else if (errno != ERANGE) {
+                        goto err;
+                }
+
+                ret = glfs_getxattr (fs, path, "glusterfs.pathinfo", NULL, 0);
+                if (ret == -1) {
+                        goto err;
+                }
+
+                len = ret;
+        }
+
+        if (ret < 0) {
+                errno = ERANGE;
+                goto err;
+        }
+
+        for (tag = strchr (pathinfo, '<'); tag; tag = strchr (end, '<')) {
+                tag++;
+                end = strchr (tag, '>');
+                if (end == NULL) {
+                        break;
+                }
+
+                if (strncmp (tag, "DISTRIBUTE:", 11) == 0
+                                || strncmp (tag, "TIER:", 5) == 0) {
+                        continue;
+                }
+
+                // A brick is named by its directory and host, without the
+                // path of the file on it.
+                if (strncmp (tag, "POSIX(", 6) == 0) {
+                        tmp = strstr (tag, "):");
+                        if (tmp && (tmp = strchr (tmp + 2, ':')) && tmp < end) {
+                                end = tmp;
                         }
                 }
+
+                *end = '\0';
+                memmove (pathinfo, tag, end - tag + 1);
+
+                return pathinfo;
         }
 
+        errno = ENODATA;
 err:
-        ret = -1;
-out:
-        return ret;
+        free (pathinfo);
+
+        return NULL;
 }
 
-int
-gluster_getfs (glfs_t **fs, const struct gluster_url *gluster_url) {
-        int ret = 0;
+/**
+ * Returns whether fs and other are connected to the same volume. They are
+ * told apart by the ID of the volume, as its URL can name it in many ways:
+ * by any of its servers, or by an address rather than a host name. Volumes
+ * whose ID can't be had are taken to differ.
+ */
+bool
+gluster_same_volume (glfs_t *fs, glfs_t *other)
+{
+        char id[GLFS_VOLUME_ID_SIZE];
+        char other_id[GLFS_VOLUME_ID_SIZE];
+        int len;
 
-        *fs = glfs_new (gluster_url->volume);
-        if (fs == NULL) {
-                goto out;
+        if (fs == other) {
+                return true;
         }
 
-        ret = glfs_set_volfile_server (*fs,
-                        "tcp",
-                        gluster_url->host,
-                        gluster_url->port);
-        if (ret == -1) {
-                goto out;
+        len = glfs_get_volumeid (fs, id, sizeof (id));
+        if (len <= 0 || len != glfs_get_volumeid (other, other_id, sizeof (other_id))) {
+                return false;
         }
 
-        ret = glfs_init (*fs);
-
-out:
-        return ret;
+        return memcmp (id, other_id, len) == 0;
 }
 
 struct xlator_option *
@@ -551,3 +775,144 @@ err:
 out:
         return port;
 }
+
+/**
+ * Parses a size in bytes, optionally followed by one of the binary suffixes
+ * K, M, G or T. Returns -1 if str is not such a size.
+ */
+off_t
+strtosize (const char *str)
+{
+        long long size;
+        int shift = 0;
+        char *end;
+
+        errno = 0;
+        size = strtoll (str, &end, 10);
+        if (errno != 0 || str == end || size < 0) {
+                goto err;
+        }
+
+        switch (*end) {
+                case 'K': case 'k':
+                        shift = 10;
+                        break;
+                case 'M': case 'm':
+                        shift = 20;
+                        break;
+                case 'G': case 'g':
+                        shift = 30;
+                        break;
+                case 'T': case 't':
+                        shift = 40;
+                        break;
+                case '\0':
+                        break;
+                default:
+                        goto err;
+        }
+
+        if (shift != 0 && *++end != '\0') {
+                goto err;
+        }
+
+        if (size > (INT64_MAX >> shift)) {
+                goto err;
+        }
+
+        return (off_t) size << shift;
+
+err:
+        return -1;
+}
+
+/**
+ * Hands out a page-aligned buffer of size bytes, reusing an idle one of the
+ * same kind if there is one. With huge_pages, large buffers are also backed by
+ * transparent huge pages where the kernel allows it, which spares the TLB when
+ * large blocks are streamed through them. Returns NULL with errno set on
+ * failure.
+ */
+void *
+buffer_pool_get (size_t size, bool huge_pages)
+{
+        void *buf = NULL;
+        size_t alignment;
+        unsigned int i;
+        int ret;
+
+        pthread_mutex_lock (&buffer_pool.lock);
+        for (i = buffer_pool.nidle; i > 0; i--) {
+                if (buffer_pool.idle[i - 1].size == size
+                                && buffer_pool.idle[i - 1].huge_pages == huge_pages) {
+                        buf = buffer_pool.idle[i - 1].buf;
+                        buffer_pool.idle[i - 1] = buffer_pool.idle[--buffer_pool.nidle];
+                        buffer_pool.idle_bytes -= size;
+                        break;
+                }
+        }
+        pthread_mutex_unlock (&buffer_pool.lock);
+
+        if (buf) {
+                return buf;
+        }
+
+        alignment = sysconf (_SC_PAGESIZE);
+        if (huge_pages && size >= HUGE_PAGE_SIZE) {
+                alignment = HUGE_PAGE_SIZE;
+        }
+
+        ret = posix_memalign (&buf, alignment, size);
+        if (ret != 0) {
+                errno = ret;
+                return NULL;
+        }
+
+        // Only a hint; kernels without THP simply say no.
+        if (alignment == HUGE_PAGE_SIZE) {
+                madvise (buf, size, MADV_HUGEPAGE);
+        }
+
+        return buf;
+}
+
+/**
+ * Returns a buffer obtained from buffer_pool_get () with the same arguments
+ * for reuse, or frees it if the pool is already holding enough memory.
+ */
+void
+buffer_pool_put (void *buf, size_t size, bool huge_pages)
+{
+        if (buf == NULL) {
+                return;
+        }
+
+        pthread_mutex_lock (&buffer_pool.lock);
+        if (buffer_pool.nidle < BUFFER_POOL_MAX_IDLE
+                        && buffer_pool.idle_bytes + size <= BUFFER_POOL_MAX_BYTES) {
+                buffer_pool.idle[buffer_pool.nidle].buf = buf;
+                buffer_pool.idle[buffer_pool.nidle].size = size;
+                buffer_pool.idle[buffer_pool.nidle].huge_pages = huge_pages;
+                buffer_pool.nidle++;
+                buffer_pool.idle_bytes += size;
+                buf = NULL;
+        }
+        pthread_mutex_unlock (&buffer_pool.lock);
+
+        free (buf);
+}
+
+/**
+ * Frees every idle buffer.
+ */
+void
+buffer_pool_drain ()
+{
+        pthread_mutex_lock (&buffer_pool.lock);
+        while (buffer_pool.nidle > 0) {
+                free (buffer_pool.idle[--buffer_pool.nidle].buf);
+        }
+
+        buffer_pool.idle_bytes = 0;
+        pthread_mutex_unlock (&buffer_pool.lock);
+}
@@ -25,10 +25,17 @@
 #define BUFSIZE 256*1024
 #define GLUSTER_DEFAULT_PORT 24007
 
+// Limits on the idle buffers kept around for reuse.
+#define BUFFER_POOL_MAX_IDLE 256
+#define BUFFER_POOL_MAX_BYTES (256 * 1024 * 1024)
+
 #include <glusterfs/api/glfs.h>
 #include <stdint.h>
 #include <stdbool.h>
 
+struct transfer_connections;
+struct transfer_options;
+
 struct gluster_url {
         char *host;
         char *path;
@@ -53,6 +60,15 @@ append_path (const char *base_path, const char *hanging_path);
 int
 apply_xlator_options (glfs_t *fs, struct xlator_option **options);
 
+void
+buffer_pool_drain ();
+
+void *
+buffer_pool_get (size_t size, bool huge_pages);
+
+void
+buffer_pool_put (void *buf, size_t size, bool huge_pages);
+
 void
 close_stdout ();
 
@@ -75,17 +91,34 @@ int
 gluster_lock (glfs_fd_t *fd, short type, bool block);
 
 int
-gluster_write (int src, glfs_fd_t *fd);
+gluster_write (int src, glfs_fd_t *fd, const struct transfer_options *options);
 
 int
-gluster_read (glfs_fd_t *fd, int dst);
+gluster_read (glfs_fd_t *fd, int dst, const struct transfer_options *options);
 
 int
 gluster_getfs (glfs_t **fs, const struct gluster_url *gluster_url);
 
+int
+gluster_getfs_connections (struct transfer_connections *conns, glfs_t *fs,
+                unsigned int count, const struct gluster_url *gluster_url,
+                struct xlator_option **options);
+
+void
+gluster_fini_connections (struct transfer_connections *conns);
+
 int
 gluster_parse_url (char *url, struct gluster_url **gluster_url);
 
+size_t
+gluster_stripe_width (glfs_t *fs);
+
+char *
+gluster_get_subvolume (glfs_t *fs, const char *path);
+
+bool
+gluster_same_volume (glfs_t *fs, glfs_t *other);
+
 struct gluster_url*
 gluster_url_init ();
 
@@ -98,4 +131,7 @@ print_xlator_options (struct xlator_option **options);
 uint16_t
 strtoport (const char *str);
 
+off_t
+strtosize (const char *str);
+
 #endif
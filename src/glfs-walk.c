@@ -0,0 +1,324 @@
+/**
+ * A pool of threads working through a tree of items, such as the entries
+ * below a directory, that only turns up as it is walked.
+ *
+ * Copyright (C) 2015 Facebook Inc.
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "glfs-walk.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define WALK_QUEUE_SIZE 64
+
+/**
+ * The items waiting for one worker, as a ring that grows as needed. The
+ * worker takes the newest item from the tail, so it goes depth first and
+ * keeps the queue short, while the others steal the oldest from the head,
+ * which tend to be the largest parts of the tree left.
+ */
+struct walk_queue {
+        pthread_mutex_t lock;
+        void **items;
+        size_t size;
+        size_t head;
+        size_t count;
+};
+
+/**
+ * queued: Items pushed that no worker has taken yet.
+ * pending: Items pushed that haven't been visited yet, the ones being visited
+ *          included. Once it drops to zero, the walk is over.
+ * failed: Whether any item failed.
+ */
+struct walk {
+        pthread_mutex_t lock;
+        pthread_cond_t cond;
+        size_t queued;
+        size_t pending;
+        bool failed;
+        unsigned int workers;
+        struct walk_queue *queues;
+        walk_visit_t visit;
+        void *data;
+};
+
+struct walk_worker {
+        struct walk *walk;
+        unsigned int worker;
+};
+
+/**
+ * Returns a walk with the given number of workers, each of which calls visit
+ * on the items it is handed. data is passed along to visit through walk_data.
+ */
+struct walk *
+walk_create (unsigned int workers, walk_visit_t visit, void *data)
+{
+        struct walk *walk;
+        unsigned int i;
+
+        if (workers == 0) {
+                workers = 1;
+        }
+
+        walk = calloc (1, sizeof (*walk));
+        if (walk == NULL) {
+                return NULL;
+        }
+
+        walk->queues = calloc (workers, sizeof (*walk->queues));
+        if (walk->queues == NULL) {
+                free (walk);
+                return NULL;
+        }
+
+        pthread_mutex_init (&walk->lock, NULL);
+        pthread_cond_init (&walk->cond, NULL);
+        walk->workers = workers;
+        walk->visit = visit;
+        walk->data = data;
+
+        for (i = 0; i < workers; i++) {
+                pthread_mutex_init (&walk->queues[i].lock, NULL);
+        }
+
+        return walk;
+}
+
+/**
+ * Frees walk, which must not have any items left in it.
+ */
+void
+walk_destroy (struct walk *walk)
+{
+        unsigned int i;
+
+        for (i = 0; i < walk->workers; i++) {
+                pthread_mutex_destroy (&walk->queues[i].lock);
+                free (walk->queues[i].items);
+        }
+
+        pthread_cond_destroy (&walk->cond);
+        pthread_mutex_destroy (&walk->lock);
+        free (walk->queues);
+        free (walk);
+}
+
+void *
+walk_data (struct walk *walk)
+{
+        return walk->data;
+}
+
+/**
+ * Makes room for one more item in queue, which must be locked.
+ */
+static int
+grow_queue (struct walk_queue *queue)
+{
+        size_t size = queue->size ? queue->size * 2 : WALK_QUEUE_SIZE;
+        void **items;
+        size_t i;
+
+        items = malloc (size * sizeof (*items));
+        if (items == NULL) {
+                return -1;
+        }
+
+        for (i = 0; i < queue->count; i++) {
+                items[i] = queue->items[(queue->head + i) % queue->size];
+        }
+
+        free (queue->items);
+        queue->items = items;
+        queue->size = size;
+        queue->head = 0;
+
+        return 0;
+}
+
+/**
+ * Hands item to worker, to be visited by it or by whichever worker runs out
+ * of items first. Returns -1 with errno set if it can't be queued, in which
+ * case the item is still the caller's.
+ */
+int
+walk_push (struct walk *walk, unsigned int worker, void *item)
+{
+        struct walk_queue *queue = &walk->queues[worker % walk->workers];
+        int ret = 0;
+
+        // The item is counted before it shows up in the queue, so that it
+        // is never taken before it is counted. A worker that is told there
+        // is an item before it can find it just looks again.
+        pthread_mutex_lock (&walk->lock);
+        walk->queued++;
+        walk->pending++;
+        pthread_mutex_unlock (&walk->lock);
+
+        pthread_mutex_lock (&queue->lock);
+        if (queue->count == queue->size) {
+                ret = grow_queue (queue);
+        }
+
+        if (ret == 0) {
+                queue->items[(queue->head + queue->count) % queue->size] = item;
+                queue->count++;
+        }
+        pthread_mutex_unlock (&queue->lock);
+
+        pthread_mutex_lock (&walk->lock);
+        if (ret == -1) {
+                walk->queued--;
+                walk->pending--;
+        } else {
+                pthread_cond_signal (&walk->cond);
+        }
+        pthread_mutex_unlock (&walk->lock);
+
+        if (ret == -1) {
+                errno = ENOMEM;
+        }
+
+        return ret;
+}
+
+/**
+ * Takes the newest item off the queue of worker, or else the oldest item off
+ * the queue of another worker. Returns NULL if every queue is empty.
+ */
+static void *
+take_item (struct walk *walk, unsigned int worker)
+{
+        struct walk_queue *queue;
+        void *item = NULL;
+        unsigned int i;
+
+        queue = &walk->queues[worker];
+        pthread_mutex_lock (&queue->lock);
+        if (queue->count > 0) {
+                queue->count--;
+                item = queue->items[(queue->head + queue->count) % queue->size];
+        }
+        pthread_mutex_unlock (&queue->lock);
+
+        for (i = 1; item == NULL && i < walk->workers; i++) {
+                queue = &walk->queues[(worker + i) % walk->workers];
+                pthread_mutex_lock (&queue->lock);
+                if (queue->count > 0) {
+                        item = queue->items[queue->head];
+                        queue->head = (queue->head + 1) % queue->size;
+                        queue->count--;
+                }
+                pthread_mutex_unlock (&queue->lock);
+        }
+
+        return item;
+}
+
+static void *
+walk_worker (void *arg)
+{
+        struct walk_worker *self = arg;
+        struct walk *walk = self->walk;
+        void *item;
+        int ret;
+
+        while (true) {
+                item = take_item (walk, self->worker);
+
+                pthread_mutex_lock (&walk->lock);
+                if (item == NULL) {
+                        while (walk->queued == 0 && walk->pending > 0) {
+                                pthread_cond_wait (&walk->cond, &walk->lock);
+                        }
+
+                        if (walk->pending == 0) {
+                                pthread_mutex_unlock (&walk->lock);
+                                break;
+                        }
+
+                        pthread_mutex_unlock (&walk->lock);
+                        continue;
+                }
+
+                walk->queued--;
+                pthread_mutex_unlock (&walk->lock);
+
+                ret = walk->visit (walk, self->worker, item);
+
+                pthread_mutex_lock (&walk->lock);
+                if (ret == -1) {
+                        walk->failed = true;
+                }
+
+                walk->pending--;
+                if (walk->pending == 0) {
+                        pthread_cond_broadcast (&walk->cond);
+                }
+                pthread_mutex_unlock (&walk->lock);
+        }
+
+        return NULL;
+}
+
+/**
+ * Visits the items pushed so far, and every item pushed while visiting them,
+ * with the workers of walk, the first of which is the calling thread. Should
+ * fewer threads start, the ones that do take over the queues of the rest.
+ * Returns -1 if any item failed, once all of them are done.
+ */
+int
+walk_run (struct walk *walk)
+{
+        struct walk_worker *workers;
+        pthread_t *threads;
+        struct walk_worker self = { walk, 0 };
+        unsigned int started = 0;
+        unsigned int i;
+
+        workers = calloc (walk->workers, sizeof (*workers));
+        threads = calloc (walk->workers, sizeof (*threads));
+
+        for (i = 1; workers && threads && i < walk->workers; i++) {
+                workers[i].walk = walk;
+                workers[i].worker = i;
+                if (pthread_create (&threads[started], NULL, walk_worker,
+                                    &workers[i]) != 0) {
+                        break;
+                }
+
+                started++;
+        }
+
+        walk_worker (&self);
+
+        while (started > 0) {
+                pthread_join (threads[--started], NULL);
+        }
+
+        free (threads);
+        free (workers);
+
+        return walk->failed ? -1 : 0;
+}
@@ -0,0 +1,45 @@
+/**
+ * Copyright (C) 2015 Facebook Inc.
+ *
+ *      This program is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation; either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      This program is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GLFS_WALK_H
+#define GLFS_WALK_H
+
+struct walk;
+
+/**
+ * Handles one item of a walk, in the given worker. Any items it comes across
+ * are handed back with walk_push. Returns -1 if the item failed.
+ */
+typedef int (*walk_visit_t)(struct walk *walk, unsigned int worker, void *item);
+
+struct walk *
+walk_create (unsigned int workers, walk_visit_t visit, void *data);
+
+void
+walk_destroy (struct walk *walk);
+
+void *
+walk_data (struct walk *walk);
+
+int
+walk_push (struct walk *walk, unsigned int worker, void *item);
+
+int
+walk_run (struct walk *walk);
+
+#endif /* GLFS_WALK_H */
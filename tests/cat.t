@@ -34,6 +34,41 @@ teardown() {
         [ "$output" == "gfcat: invalid port number: \"test\"" ]
 }
 
+@test "invalid queue depth flag" {
+        run $CMD "--queue-depth=0" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcat: invalid queue depth: \"0\"" ]
+}
+
+@test "invalid block size flag" {
+        run $CMD "--block-size=1" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcat: invalid block size: \"1\"" ]
+}
+
+@test "invalid buffer size flag" {
+        run $CMD "--buffer-size=1" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcat: invalid buffer size: \"1\"" ]
+}
+
+@test "invalid stats flag" {
+        run $CMD "--stats=xml" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcat: invalid stats format: \"xml\"" ]
+}
+
+@test "invalid connections flag" {
+        run $CMD "--connections=0" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcat: invalid number of connections: \"0\"" ]
+}
+
 @test "uri only" {
         run $CMD "glfs://"
 
@@ -10,6 +10,9 @@ setup() {
 
 teardown() {
         rm -rf "$TEMP_FILE"
+        rm -rf "$TEMP_FILE.journal"
+        rm -rf "$TEMP_FILE.dir"
+        rm -rf "$TEMP_FILE.list"
         rm -rf "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test"
 }
 
@@ -34,6 +37,55 @@ teardown() {
         [ "$output" == "gfcp: invalid port number: \"test\"" ]
 }
 
+@test "invalid queue depth flag" {
+        run $CMD "--queue-depth=0" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcp: invalid queue depth: \"0\"" ]
+}
+
+@test "invalid block size flag" {
+        run $CMD "--block-size=1" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcp: invalid block size: \"1\"" ]
+}
+
+@test "invalid buffer size flag" {
+        run $CMD "--buffer-size=1" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcp: invalid buffer size: \"1\"" ]
+}
+
+@test "invalid bandwidth limit flag" {
+        run $CMD "--bwlimit=0" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcp: invalid bandwidth limit: \"0\"" ]
+}
+
+@test "invalid stats flag" {
+        run $CMD "--stats=xml" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcp: invalid stats format: \"xml\"" ]
+}
+
+@test "invalid connections flag" {
+        run $CMD "--connections=0" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcp: invalid number of connections: \"0\"" ]
+}
+
+@test "invalid jobs flag" {
+        run $CMD "--jobs=0" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcp: invalid number of jobs: \"0\"" ]
+}
+
 @test "source uri only" {
         run $CMD "glfs://"
 
@@ -90,6 +142,13 @@ teardown() {
         [[ "$output" =~ "gfcp: local source and destination: Invalid argument" ]]
 }
 
+@test "cp empty local file to remote destination" {
+        run $CMD "$TEMP_FILE" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
+
+        [ "$status" -eq 0 ]
+        [ ! -s "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test" ]
+}
+
 @test "cp small local file to remote destination" {
         run $CMD "$GLUSTER_BRICK_DIR$ROOT_DIR/$TEST_FILE_SMALL" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
         result=$(md5sum "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test" | awk '{print $1}')
@@ -114,6 +173,38 @@ teardown() {
         [ "$result" == "$TEST_FILE_LARGE_HASH" ]
 }
 
+@test "cp large local file to remote destination with queue depth" {
+        run $CMD "--queue-depth=8" "$GLUSTER_BRICK_DIR$ROOT_DIR/$TEST_FILE_LARGE" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
+        result=$(md5sum "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp sparse local file to remote destination" {
+        truncate -s 64M "$TEMP_FILE"
+        dd if=/dev/urandom of="$TEMP_FILE" bs=64K count=1 seek=512 conv=notrunc
+        expected=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        run $CMD "$TEMP_FILE" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
+        result=$(md5sum "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test" | awk '{print $1}')
+        size=$(stat -c %s "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test")
+        allocated=$(( $(stat -c %b "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test") * 512 ))
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$expected" ]
+        [ "$size" -eq 67108864 ]
+        [ "$allocated" -lt $(( size / 8 )) ]
+}
+
+@test "cp remote file within a volume named by different hosts" {
+        run $CMD "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "glfs://127.0.0.1/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
+        result=$(md5sum "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
 @test "cp small remote file to local destination" {
         run $CMD "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_SMALL" "$TEMP_FILE"
         result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
@@ -138,6 +229,263 @@ teardown() {
         [ "$result" == "$TEST_FILE_LARGE_HASH" ]
 }
 
+@test "cp large remote file to local destination with jobs" {
+        run $CMD "--jobs=4" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large remote file to local destination with bandwidth limit" {
+        run $CMD "--bwlimit=64M" "--iops-limit=1000" "--jobs=4" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large remote file to local destination with target latency" {
+        run $CMD "--target-latency=20ms" "--jobs=4" "--queue-depth=8" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large remote file to local destination with io_uring" {
+        run $CMD "--io-uring" "--queue-depth=8" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+
+        if [ "$output" == "gfcp: built without io_uring support" ]; then
+                skip "built without io_uring support"
+        fi
+
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large local file to remote destination with io_uring" {
+        # Reads that miss the page cache are the ones the kernel finishes in
+        # the background.
+        cp "$GLUSTER_BRICK_DIR$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        dd if="$TEMP_FILE" iflag=nocache count=0 status=none
+
+        run $CMD "--io-uring" "--queue-depth=8" "$TEMP_FILE" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
+
+        if [ "$output" == "gfcp: built without io_uring support" ]; then
+                skip "built without io_uring support"
+        fi
+
+        result=$(md5sum "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large local file to remote destination with io_uring and jobs" {
+        cp "$GLUSTER_BRICK_DIR$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        dd if="$TEMP_FILE" iflag=nocache count=0 status=none
+
+        run $CMD "--io-uring" "--queue-depth=8" "--jobs=4" "$TEMP_FILE" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
+
+        if [ "$output" == "gfcp: built without io_uring support" ]; then
+                skip "built without io_uring support"
+        fi
+
+        result=$(md5sum "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large remote file to local destination with mmap" {
+        run $CMD "--mmap" "--queue-depth=8" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large local file to remote destination with mmap and bandwidth limit" {
+        run $CMD "--mmap" "--bwlimit=64M" "--queue-depth=8" "$GLUSTER_BRICK_DIR$ROOT_DIR/$TEST_FILE_LARGE" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
+        result=$(md5sum "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large remote file to local destination with direct I/O" {
+        run $CMD "--direct" "--queue-depth=8" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large local file to remote destination with direct I/O and io_uring" {
+        cp "$GLUSTER_BRICK_DIR$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+
+        run $CMD "--direct" "--io-uring" "--queue-depth=8" "$TEMP_FILE" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
+
+        if [ "$output" == "gfcp: built without io_uring support" ]; then
+                skip "built without io_uring support"
+        fi
+
+        result=$(md5sum "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large remote file to local destination with large buffers" {
+        run $CMD "--buffer-size=4M" "--buffers=8" "--huge-pages" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large remote file to local destination with automatic block size" {
+        run $CMD "--block-size=auto" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large remote file to local destination with json statistics" {
+        run $CMD "--stats=json" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+        [[ "${lines[0]}" == "{\"elapsed\": "*"\"final\": true}" ]]
+}
+
+@test "cp large remote file to local destination with verification" {
+        run $CMD "--verify" "--jobs=4" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp large remote file to partially copied local destination with resume" {
+        head -c 1000000 "$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_FILE_LARGE" > "$TEMP_FILE"
+        run $CMD "--resume=$TEMP_FILE.journal" "--jobs=4" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+        [ ! -e "$TEMP_FILE.journal" ]
+}
+
+@test "cp large remote file over modified local destination with delta" {
+        cp "$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        printf 'delta' | dd of="$TEMP_FILE" bs=1 seek=1000 conv=notrunc
+        run $CMD "--delta" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE"
+        result=$(md5sum "$TEMP_FILE" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "cp local directory to remote destination without recursive" {
+        mkdir "$TEMP_FILE.dir"
+        run $CMD "$TEMP_FILE.dir" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
+
+        [ "$status" -eq 1 ]
+        [ ! -e "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test" ]
+}
+
+@test "cp local directory to remote destination recursively with jobs" {
+        mkdir -p "$TEMP_FILE.dir/a/b" "$TEMP_FILE.dir/c"
+        cp "$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_FILE_SMALL" "$TEMP_FILE.dir/a/small"
+        cp "$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_FILE_MEDIUM" "$TEMP_FILE.dir/a/b/medium"
+        cp "$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_FILE_LARGE" "$TEMP_FILE.dir/c/large"
+        ln -s ../a/small "$TEMP_FILE.dir/c/link"
+        run $CMD "-r" "--jobs=4" "$TEMP_FILE.dir" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
+
+        [ "$status" -eq 0 ]
+        diff -r --no-dereference "$TEMP_FILE.dir" "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test"
+}
+
+@test "cp local directory with hard links to remote destination recursively" {
+        mkdir -p "$TEMP_FILE.dir/a" "$TEMP_FILE.dir/b"
+        cp "$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_FILE_MEDIUM" "$TEMP_FILE.dir/a/medium"
+        ln "$TEMP_FILE.dir/a/medium" "$TEMP_FILE.dir/b/medium"
+        run $CMD "-r" "--jobs=2" "$TEMP_FILE.dir" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
+        first=$(stat -c %i "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test/a/medium")
+        second=$(stat -c %i "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test/b/medium")
+
+        [ "$status" -eq 0 ]
+        [ "$first" == "$second" ]
+        diff -r "$TEMP_FILE.dir" "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test"
+}
+
+@test "cp remote files to local destinations from list" {
+        mkdir "$TEMP_FILE.dir"
+        printf 'glfs://%s/%s%s/%s\t%s\n' \
+                "$HOST" "$GLUSTER_VOLUME" "$ROOT_DIR" "$TEST_FILE_SMALL" "$TEMP_FILE.dir/small" \
+                "$HOST" "$GLUSTER_VOLUME" "$ROOT_DIR" "$TEST_FILE_MEDIUM" "$TEMP_FILE.dir/medium" \
+                > "$TEMP_FILE.list"
+        run $CMD "--jobs=2" "--from-list=$TEMP_FILE.list"
+        small=$(md5sum "$TEMP_FILE.dir/small" | awk '{print $1}')
+        medium=$(md5sum "$TEMP_FILE.dir/medium" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$small" == "$TEST_FILE_SMALL_HASH" ]
+        [ "$medium" == "$TEST_FILE_MEDIUM_HASH" ]
+        [ "$(grep -c '^ok' <<< "$output")" -eq 2 ]
+}
+
+@test "cp remote files to local destinations from list with brick jobs" {
+        mkdir "$TEMP_FILE.dir"
+        printf 'glfs://%s/%s%s/%s\t%s\n' \
+                "$HOST" "$GLUSTER_VOLUME" "$ROOT_DIR" "$TEST_FILE_SMALL" "$TEMP_FILE.dir/small" \
+                "$HOST" "$GLUSTER_VOLUME" "$ROOT_DIR" "$TEST_FILE_MEDIUM" "$TEMP_FILE.dir/medium" \
+                "$HOST" "$GLUSTER_VOLUME" "$ROOT_DIR" "$TEST_FILE_LARGE" "$TEMP_FILE.dir/large" \
+                > "$TEMP_FILE.list"
+        run $CMD "--jobs=3" "--brick-jobs=1" "--from-list=$TEMP_FILE.list"
+        small=$(md5sum "$TEMP_FILE.dir/small" | awk '{print $1}')
+        medium=$(md5sum "$TEMP_FILE.dir/medium" | awk '{print $1}')
+        large=$(md5sum "$TEMP_FILE.dir/large" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$small" == "$TEST_FILE_SMALL_HASH" ]
+        [ "$medium" == "$TEST_FILE_MEDIUM_HASH" ]
+        [ "$large" == "$TEST_FILE_LARGE_HASH" ]
+        [ "$(grep -c '^ok' <<< "$output")" -eq 3 ]
+}
+
+@test "cp from list with a malformed entry" {
+        printf 'no destination\n' > "$TEMP_FILE.list"
+        run $CMD "--from-list=$TEMP_FILE.list"
+
+        [ "$status" -eq 1 ]
+        [ "${lines[0]}" == "gfcp: $TEMP_FILE.list:1: expected a source and a destination" ]
+}
+
+@test "cp several remote files to local directory with jobs" {
+        mkdir "$TEMP_FILE.dir"
+        run $CMD "--jobs=2" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_SMALL" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_MEDIUM" "$TEMP_FILE.dir"
+        small=$(md5sum "$TEMP_FILE.dir/$TEST_FILE_SMALL" | awk '{print $1}')
+        medium=$(md5sum "$TEMP_FILE.dir/$TEST_FILE_MEDIUM" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$small" == "$TEST_FILE_SMALL_HASH" ]
+        [ "$medium" == "$TEST_FILE_MEDIUM_HASH" ]
+}
+
+@test "cp several remote files to local file" {
+        run $CMD "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_SMALL" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_MEDIUM" "$TEMP_FILE"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfcp: target '$TEMP_FILE' is not a directory" ]
+}
+
 @test "cp small remote file to remote destination" {
         run $CMD "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_FILE_SMALL" "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfcp_test"
         result=$(md5sum "$GLUSTER_BRICK_DIR$ROOT_DIR/gfcp_test" | awk '{print $1}')
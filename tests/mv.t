@@ -0,0 +1,43 @@
+#!/usr/bin/env bats
+
+CMD="$CMD_PREFIX $BUILD_DIR/bin/gfmv"
+USAGE="Usage: gfmv [OPTION]... SOURCE DEST"
+USAGE_ERROR="gfmv: missing operand"
+
+setup() {
+        TEST_MV_FILE=$(mktemp --tmpdir="$GLUSTER_MOUNT_DIR$ROOT_DIR")
+        TEST_MV_FILE=$(basename "$TEST_MV_FILE")
+        head -c 1M /dev/urandom > "$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_MV_FILE"
+}
+
+teardown() {
+        rm -f "$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_MV_FILE"
+        rm -f "$GLUSTER_MOUNT_DIR$ROOT_DIR/gfmv_test"
+}
+
+@test "no arguments" {
+        run $CMD
+
+        [ "$status" -eq 1 ]
+        [[ "$output" =~ "$USAGE_ERROR" ]]
+}
+
+@test "long help flag" {
+        run $CMD "--help"
+
+        [ "$status" -eq 0 ]
+        [[ "$output" =~ "$USAGE" ]]
+}
+
+@test "mv remote file within a volume named by different hosts" {
+        expected=$(md5sum "$GLUSTER_BRICK_DIR$ROOT_DIR/$TEST_MV_FILE" | awk '{print $1}')
+        inode=$(stat -c %i "$GLUSTER_BRICK_DIR$ROOT_DIR/$TEST_MV_FILE")
+
+        run $CMD "glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_MV_FILE" "glfs://127.0.0.1/$GLUSTER_VOLUME$ROOT_DIR/gfmv_test"
+        result=$(md5sum "$GLUSTER_BRICK_DIR$ROOT_DIR/gfmv_test" | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$expected" ]
+        [ ! -e "$GLUSTER_BRICK_DIR$ROOT_DIR/$TEST_MV_FILE" ]
+        [ "$(stat -c %i "$GLUSTER_BRICK_DIR$ROOT_DIR/gfmv_test")" -eq "$inode" ]
+}
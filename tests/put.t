@@ -29,6 +29,48 @@ teardown() {
         [ "$output" == "gfput: invalid port number: \"test\"" ]
 }
 
+@test "invalid queue depth flag" {
+        run $CMD "--queue-depth=0" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfput: invalid queue depth: \"0\"" ]
+}
+
+@test "invalid block size flag" {
+        run $CMD "--block-size=1" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfput: invalid block size: \"1\"" ]
+}
+
+@test "invalid buffer size flag" {
+        run $CMD "--buffer-size=1" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfput: invalid buffer size: \"1\"" ]
+}
+
+@test "invalid stats flag" {
+        run $CMD "--stats=xml" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfput: invalid stats format: \"xml\"" ]
+}
+
+@test "invalid connections flag" {
+        run $CMD "--connections=0" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfput: invalid number of connections: \"0\"" ]
+}
+
+@test "invalid size flag" {
+        run $CMD "--size=1Q" "glfs://host/volume/file"
+
+        [ "$status" -eq 1 ]
+        [ "$output" == "gfput: invalid size: \"1Q\"" ]
+}
+
 @test "uri only" {
         run $CMD "glfs://"
 
@@ -99,6 +141,28 @@ teardown() {
         [ "$result" == "$TEST_FILE_LARGE_HASH" ]
 }
 
+@test "put large file with a size hint" {
+        run bash -c "cat \"$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_FILE_LARGE\" | $CMD \"--size=1G\" \"glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfput_test\""
+        result=$(md5sum $GLUSTER_MOUNT_DIR$ROOT_DIR/gfput_test | awk '{print $1}')
+
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "put large file over several connections" {
+        run bash -c "cat \"$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_FILE_LARGE\" | $CMD \"--connections=4\" \"glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfput_test\""
+        result=$(md5sum $GLUSTER_MOUNT_DIR$ROOT_DIR/gfput_test | awk '{print $1}')
+
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
+@test "put large file with verification" {
+        run bash -c "cat \"$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_FILE_LARGE\" | $CMD \"--verify\" \"glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/gfput_test\""
+        result=$(md5sum $GLUSTER_MOUNT_DIR$ROOT_DIR/gfput_test | awk '{print $1}')
+
+        [ "$status" -eq 0 ]
+        [ "$result" == "$TEST_FILE_LARGE_HASH" ]
+}
+
 @test "put file into subdir that does not exist with parent flag" {
         run bash -c "cat \"$GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_FILE_SMALL\" | $CMD \"-r\" \"glfs://$HOST/$GLUSTER_VOLUME$ROOT_DIR/$TEST_DIR/gfput_test\""
         result=$(md5sum $GLUSTER_MOUNT_DIR$ROOT_DIR/$TEST_DIR/gfput_test | awk '{print $1}')